@@ -1,28 +1,122 @@
 #define _GNU_SOURCE // for asprintf
 
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
+#include "opencl_device.h"
+#include "opencl_primitives.h"
+#include "opencl_tune.h"
 #include "opencl_utils.h"
 
+// Work-groups of the mandelbrot kernel for each compute unit
+#define GROUPS_PER_COMPUTE_UNIT 4
+
 typedef struct {
-   cl_float x[2];
-   cl_float y[2];
+   long double x[2];
+   long double y[2];
    size_t dim[2];
    cl_uint max_iter;
    cl_uint ncol;
+   size_t tile_rows;
+   uint32_t max_devices;
+   uint32_t frames;
+   long double zoom;
+   bool fp64;
+   bool perturbation;
+   bool subdivision;
+   bool native;
+   bool check_reuse;
    char* outfile;
+   char* keyfile;
 } parameters;
 
-static bool prefix_sum(opencl_handle* handle, cl_mem buffer, cl_uint buffer_size);
+typedef struct {
+   long double x[2];
+   long double y[2];
+} view;
+
+// Everything needed for rendering on one device. Each device gets a context of its own,
+// so that devices of different platforms can work together.
+typedef struct {
+   opencl_handle opencl;
+   cl_program program;
+   cl_kernel mandelbrot_kernel, reuse_kernel, merge_kernel;
+   cl_mem hist_buffer, partial_buffer, orbit_buffer;
+   opencl_primitives primitives;
+   size_t local_size[2], global_size[2];
+   cl_uint local_bins, n_groups;
+   cl_uint vector_width; // pixels per work-item, 0 for the scalar kernel
+   uint32_t* zero_histogram;
+   // Tiled rendering, allocated on first use and kept for the next frames
+   cl_command_queue read_queue;
+   cl_mem tile_buffers[2];
+} renderer;
+
+// Output image: the raw 32-bit colours as they are, or with the palette applied, a binary
+// PPM or a PNG, by the extension of the file name. Either way rows are encoded as they come.
+typedef enum { IMAGE_RAW, IMAGE_PPM, IMAGE_PNG } image_format;
+
+typedef struct {
+   const parameters* params;
+   const char* name;
+   image_format format;
+   FILE* file;
+   uint8_t (*palette)[3];
+   uint8_t* row;
+   z_stream stream;
+   uint8_t* chunk;
+} image_writer;
+
+// Tiles of the image, handed out in order to whichever device asks for one next.
+typedef struct {
+   const parameters* params;
+   size_t tile_rows;
+   size_t n_tiles;
+   atomic_size_t next;
+   const char* outfile;
+   int out_fd;
+} tile_queue;
+
+static bool renderer_init(renderer* r, cl_device_id device, const parameters* params);
+static bool renderer_start_frame(renderer* r, const parameters* params, const view* frame, bool clear_histogram);
+static bool renderer_free(renderer* r);
+static bool render_frames(renderer* r, const parameters* params, const view* views, uint32_t n_frames);
+static bool render_tiled(renderer* renderers, uint32_t n_renderers, const parameters* params, size_t tile_rows,
+                         const char* outfile);
+static bool histogram_layout(opencl_handle* opencl, cl_kernel kernel, const parameters* params,
+                             cl_uint vector_width, size_t* local_size, size_t* global_size, cl_uint* local_bins);
+static void set_real_arg(cl_kernel kernel, cl_uint index, long double value, bool fp64);
+static void* reference_orbit(const parameters* params, const view* frame, cl_uint* orbit_n);
+static view* sequence_views(const parameters* params, uint32_t* n_frames);
+static char* frame_name(const parameters* params, uint32_t frame, uint32_t n_frames);
+static bool tile_layout(renderer* renderers, uint32_t n_renderers, const parameters* params, size_t* tile_rows);
+static bool reuse_shift(const parameters* params, const view* previous, const view* frame, cl_int4* shift);
+static bool check_reuse(renderer* r, const parameters* params, cl_mem counts, cl_mem check_buffers[2], uint32_t frame);
+static bool render_native(const parameters* params, const view* views, uint32_t n_frames);
+static void print_throughput(const parameters* params, uint32_t n_frames, const struct timespec* start);
+static image_format image_format_of(const char* outfile);
+static bool image_open(image_writer* writer, const parameters* params, const char* outfile);
+static bool image_write_rows(image_writer* writer, const uint32_t* data, size_t rows);
+static bool image_close(image_writer* writer);
 static void debug_print_parameters(const parameters* param);
 
 
 static void usage(FILE* stream) {
    fprintf(stream, "Usage: mandelbrot [-w width] [-h height] [-x lo:hi] [-y lo:hi] [-o outfile]\n");
-   fprintf(stream, "                  [-m max_iter] [-c n_colors] [-d]\n");
+   fprintf(stream, "                  [-m max_iter] [-c n_colors] [-t tile_rows] [-n max_devices] [-d] [-p] [-s]\n");
+   fprintf(stream, "                  [-f frames] [-z zoom] [-k keyfile] [-r] [-H]\n");
    return;
 }
 
@@ -35,41 +129,46 @@ static void parameters_init(parameters* params) {
    params->dim[1] = 256;
    params->max_iter = 1000;
    params->ncol = 256;
+   params->tile_rows = 0;
+   params->max_devices = 0;
+   params->frames = 1;
+   params->zoom = 100;
+   params->fp64 = false;
+   params->perturbation = false;
+   params->subdivision = false;
+   params->native = false;
+   params->check_reuse = false;
    asprintf(&params->outfile, "mandelbrot.raw");
+   params->keyfile = NULL;
    return;
 }
 
-static bool write_image(const parameters* params, uint32_t* data) {
-   size_t data_size = params->dim[0] * params->dim[1] * sizeof(uint32_t);
-   FILE* out_fid = fopen(params->outfile, "w");
-   if (out_fid == NULL) {
-      printf("Creating output file '%s' failed!\n", params->outfile);
-      return false;
-   }
-   fwrite(data, data_size, 1, out_fid);
-   fclose(out_fid);
+static bool write_image(const parameters* params, const char* outfile, const uint32_t* data) {
+   image_writer writer;
 
-   return true;
+   if (!image_open(&writer, params, outfile))
+      return false;
+   if (!image_write_rows(&writer, data, params->dim[1]))
+      return false;
+   return image_close(&writer);
 }
 
 
 int main(int argc, char* argv[]) {
    opencl_handle opencl;
-   cl_program program;
-   cl_kernel* kernels = NULL;
-   cl_int n_kernels;
-   cl_kernel mandelbrot_kernel, recolor_kernel;
-   cl_mem data_buffer, hist_buffer;
-   cl_int opencl_error;
+   renderer* renderers;
+   uint32_t n_renderers;
    parameters params;
-   uint32_t *image = NULL, *histogram = NULL;
-   size_t data_size, hist_size;
+   view* views;
+   uint32_t n_frames;
+   size_t tile_rows;
+   struct timespec start;
 
    parameters_init(&params);
 
    // read command line parameters
    char opt;
-   while ( (opt = getopt(argc, argv, "w:h:x:y:o:m:c:d")) != -1) {
+   while ( (opt = getopt(argc, argv, "w:h:x:y:o:m:c:t:n:f:z:k:dpsrH")) != -1) {
       switch(opt) {
          case 'w':
             params.dim[0] = atoi(optarg);
@@ -78,12 +177,12 @@ int main(int argc, char* argv[]) {
             params.dim[1] = atoi(optarg);
             break;
          case 'x':
-            params.x[0] = strtof(strsep(&optarg, ":"), NULL);
-            params.x[1] = strtof(strsep(&optarg, ":"), NULL);
+            params.x[0] = strtold(strsep(&optarg, ":"), NULL);
+            params.x[1] = strtold(strsep(&optarg, ":"), NULL);
             break;
          case 'y':
-            params.y[0] = strtof(strsep(&optarg, ":"), NULL);
-            params.y[1] = strtof(strsep(&optarg, ":"), NULL);
+            params.y[0] = strtold(strsep(&optarg, ":"), NULL);
+            params.y[1] = strtold(strsep(&optarg, ":"), NULL);
             break;
          case 'o':
             free(params.outfile);
@@ -95,8 +194,36 @@ int main(int argc, char* argv[]) {
          case 'c':
             params.ncol = atoi(optarg);
             break;
+         case 't':
+            params.tile_rows = atoi(optarg);
+            break;
+         case 'n':
+            params.max_devices = atoi(optarg);
+            break;
+         case 'f':
+            params.frames = atoi(optarg);
+            break;
+         case 'z':
+            params.zoom = strtold(optarg, NULL);
+            break;
+         case 'k':
+            free(params.keyfile);
+            params.keyfile = strdup(optarg);
+            break;
          case 'd':
-            fprintf(stderr, "double precision not yet implemented\n");
+            params.fp64 = true;
+            break;
+         case 'p':
+            params.perturbation = true;
+            break;
+         case 's':
+            params.subdivision = true;
+            break;
+         case 'r':
+            params.check_reuse = true;
+            break;
+         case 'H':
+            params.native = true;
             break;
          default:
             usage(stderr);
@@ -107,161 +234,1395 @@ int main(int argc, char* argv[]) {
 
    printf("Simple Mandelbrot set generator\n\n");
 
-   if (!opencl_discover(&opencl, CL_DEVICE_TYPE_ALL))
+   views = sequence_views(&params, &n_frames);
+   if (views == NULL)
       return EXIT_FAILURE;
 
-   // Make it single device now.
-   if (!opencl_setup(&opencl, 1))
+   // Only the device list of the handle is used, each renderer sets up its own. Without
+   // any, the image is rendered on the host, which is also the baseline for the devices.
+   if (!params.native && !opencl_discover(&opencl, CL_DEVICE_TYPE_ALL)) {
+      printf("Rendering on the host instead\n");
+      params.native = true;
+   }
+   if (params.native) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if (!render_native(&params, views, n_frames))
+         return EXIT_FAILURE;
+      print_throughput(&params, n_frames, &start);
+      free(views);
+      free(params.outfile);
+      free(params.keyfile);
+      return EXIT_SUCCESS;
+   }
+
+   renderers = (renderer*) calloc(opencl.n_devices, sizeof(renderer));
+   if (renderers == NULL) {
+      printf("Out of memory!\n");
       return EXIT_FAILURE;
+   }
 
-   // Load kernels from a source file
-   if (!opencl_load_source_file("mandelbrot.cl", opencl.context, &program))
+   // Everything is set up once, and reused for all the frames of a sequence. Devices
+   // without double precision are skipped when it is asked for, and the tiles are shared
+   // by the others.
+   n_renderers = 0;
+   for (uint32_t d = 0; d < opencl.n_devices && (params.max_devices == 0 || n_renderers < params.max_devices); d++) {
+      char name[256];
+      if (clGetDeviceInfo(opencl.devices[d], CL_DEVICE_NAME, sizeof(name), name, NULL) == CL_SUCCESS)
+         printf("Device %u: %s\n", d, name);
+      if (params.fp64 && !opencl_device_has_fp64(opencl.devices[d])) {
+         printf("Skipping device %u, it does not support double precision\n", d);
+         continue;
+      }
+      if (!renderer_init(&renderers[n_renderers], opencl.devices[d], &params))
          return EXIT_FAILURE;
+      n_renderers++;
+   }
+   free(opencl.devices);
+   if (n_renderers == 0) {
+      printf("No device supports double precision!\n");
+      return EXIT_FAILURE;
+   }
 
-   char* options = NULL;
-   if (asprintf(&options, "-DMAX_ITER=%d", params.max_iter) < 0)
+   if (!tile_layout(renderers, n_renderers, &params, &tile_rows))
+      return EXIT_FAILURE;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   if (n_renderers == 1 && tile_rows == params.dim[1]) {
+      if (!render_frames(&renderers[0], &params, views, n_frames))
+         return EXIT_FAILURE;
+   } else {
+      // The image does not fit on the device, or there are several of them: render it in
+      // tiles that are streamed to the output file, and recolor the file afterwards.
+      printf("Rendering in tiles of %zu rows\n", tile_rows);
+      for (uint32_t f = 0; f < n_frames; f++) {
+         for (uint32_t d = 0; d < n_renderers; d++) {
+            if (!renderer_start_frame(&renderers[d], &params, &views[f], true))
+               return EXIT_FAILURE;
+         }
+         char* outfile = frame_name(&params, f, n_frames);
+         if (outfile == NULL)
+            return EXIT_FAILURE;
+         if (!render_tiled(renderers, n_renderers, &params, tile_rows, outfile))
             return EXIT_FAILURE;
-   n_kernels = opencl_build_kernels(&opencl, program, options, false);
+         free(outfile);
+      }
+   }
+   print_throughput(&params, n_frames, &start);
+
+   for (uint32_t d = 0; d < n_renderers; d++) {
+      if (!renderer_free(&renderers[d]))
+         return EXIT_FAILURE;
+   }
+   free(renderers);
+   free(views);
+   free(params.outfile);
+   free(params.keyfile);
+
+   return EXIT_SUCCESS;
+}
+
+
+// Context, kernels and histogram buffers on one device, which must support double
+// precision if it is asked for. The view is set for each frame by renderer_start_frame,
+// and the image buffers are left to the render functions.
+static bool renderer_init(renderer* r, cl_device_id device, const parameters* params) {
+   cl_int opencl_error;
+   cl_int n_kernels;
+   size_t hist_size = params->max_iter*sizeof(cl_uint);
+   cl_uint nx = params->dim[0], ny = params->dim[1];
+
+   r->opencl.devices = (cl_device_id*) malloc(sizeof(cl_device_id));
+   if (r->opencl.devices == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   r->opencl.devices[0] = device;
+   r->opencl.n_devices = 1;
+
+   if (!opencl_setup(&r->opencl, 1))
+      return false;
+   if (!opencl_primitives_init(&r->primitives, &r->opencl, 0))
+      return false;
+
+   // CPU devices get the kernel that computes strips of pixels in vector registers, as
+   // wide as the device prefers. There are no strips with perturbation or subdivision.
+   char vector_option[32] = "";
+   r->vector_width = 0;
+   if (!params->perturbation && !params->subdivision) {
+      cl_device_type type;
+      cl_uint preferred_width;
+      opencl_error = clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+      OPENCL_CHECK(opencl_error);
+      opencl_error = clGetDeviceInfo(device, params->fp64 ? CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE :
+                                     CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &preferred_width, NULL);
+      OPENCL_CHECK(opencl_error);
+      if ((type & CL_DEVICE_TYPE_CPU) && preferred_width > 1) {
+         r->vector_width = preferred_width >= 8 ? 8 : 4;
+         snprintf(vector_option, sizeof(vector_option), " -DVECTOR_WIDTH=%u", r->vector_width);
+         printf("Computing strips of %u pixels\n", r->vector_width);
+      }
+   }
+
+   // Build the kernels from a source file, or from the binaries of an earlier run
+   char* options = NULL;
+   if (asprintf(&options, "-DMAX_ITER=%d%s%s%s%s", params->max_iter, params->fp64 ? " -DMANDELBROT_DOUBLE" : "",
+                params->perturbation ? " -DPERTURBATION" : "", params->subdivision ? " -DMARIANI_SILVER" : "",
+                vector_option) < 0)
+            return false;
+   if (!opencl_build_source_file(&r->opencl, "mandelbrot.cl", options, &r->program))
+      return false;
+   n_kernels = opencl_create_kernels(&r->opencl, r->program, false);
    if (n_kernels < 0)
-      return EXIT_FAILURE;
+      return false;
    free(options);
 
    // This is getting silly, but I just want to test all features:
-   mandelbrot_kernel = opencl_get_named_kernel(&opencl, "mandelbrot");
-   if (mandelbrot_kernel == NULL)
-      return EXIT_FAILURE;
+   r->mandelbrot_kernel = opencl_get_named_kernel(&r->opencl, "mandelbrot");
+   if (r->mandelbrot_kernel == NULL)
+      return false;
 
-   data_size = params.dim[0]*params.dim[1]*sizeof(cl_uint);
-   hist_size = params.max_iter*sizeof(cl_uint);
-   image     = (uint32_t*) malloc(data_size);
-   histogram = (uint32_t*) calloc(1, hist_size);
-   if (image == NULL || histogram == NULL) {
+   r->zero_histogram = (uint32_t*) calloc(1, hist_size);
+   if (r->zero_histogram == NULL) {
       printf("Out of memory!\n");
-      return EXIT_FAILURE;
+      return false;
    }
 
-   // Create a buffer. Try first with the usual method, without mappings.
-   data_buffer = clCreateBuffer(opencl.context, CL_MEM_WRITE_ONLY, data_size, NULL, &opencl_error);
+   // Let's try something fancy for zeroing, although a kernel would do better job here.
+   r->hist_buffer = clCreateBuffer(r->opencl.context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, hist_size,
+                                   r->zero_histogram, &opencl_error);
    OPENCL_CHECK(opencl_error);
 
-   // Let's try something fancy for zeroing, although a kernel would do better job here.
-   hist_buffer = clCreateBuffer(opencl.context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, hist_size, histogram, &opencl_error);
+   // Work-group private histograms, see the mandelbrot kernel. The work-groups loop over
+   // the image, a few for each compute unit to keep the partial histograms small.
+   if (!histogram_layout(&r->opencl, r->mandelbrot_kernel, params, r->vector_width, r->local_size, r->global_size,
+                         &r->local_bins))
+      return false;
+   r->n_groups = (r->global_size[0]/r->local_size[0])*(r->global_size[1]/r->local_size[1]);
+
+   r->partial_buffer = clCreateBuffer(r->opencl.context, CL_MEM_READ_WRITE, r->n_groups*r->local_bins*sizeof(cl_uint),
+                                      NULL, &opencl_error);
    OPENCL_CHECK(opencl_error);
 
-   // Set kernel arguments
-   clSetKernelArg(mandelbrot_kernel, 0, sizeof(cl_mem), (void *)&data_buffer);
-   clSetKernelArg(mandelbrot_kernel, 1, sizeof(cl_float), (void *)&params.x[0]);
-   clSetKernelArg(mandelbrot_kernel, 2, sizeof(cl_float), (void *)&params.x[1]);
-   clSetKernelArg(mandelbrot_kernel, 3, sizeof(cl_float), (void *)&params.y[0]);
-   clSetKernelArg(mandelbrot_kernel, 4, sizeof(cl_float), (void *)&params.y[1]);
-   clSetKernelArg(mandelbrot_kernel, 5, sizeof(cl_mem), (void *)&hist_buffer);
+   // Room for the longest reference orbit
+   if (params->perturbation) {
+      size_t real_size = params->fp64 ? sizeof(cl_double) : sizeof(cl_float);
+      r->orbit_buffer = clCreateBuffer(r->opencl.context, CL_MEM_READ_ONLY, 2*(params->max_iter + 1)*real_size,
+                                       NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+   }
 
-   opencl_error = clEnqueueNDRangeKernel(opencl.queues[0], mandelbrot_kernel, 2,
-                                         NULL, params.dim, NULL, 0, NULL, NULL);
+   r->reuse_kernel = opencl_get_named_kernel(&r->opencl, "mandelbrot_reuse");
+   if (r->reuse_kernel == NULL)
+      return false;
 
-   if (!prefix_sum(&opencl, hist_buffer, params.max_iter))
-      return EXIT_FAILURE;
+   // Set kernel arguments. The view is set for each frame, the image buffer and the rows
+   // for each tile. The reuse kernel has the same arguments apart from the rows.
+   cl_kernel kernels[2] = {r->mandelbrot_kernel, r->reuse_kernel};
+   for (int k = 0; k < 2; k++) {
+      clSetKernelArg(kernels[k], 5, sizeof(cl_mem), (void *)&r->hist_buffer);
+      clSetKernelArg(kernels[k], 6, sizeof(cl_mem), (void *)&r->partial_buffer);
+      clSetKernelArg(kernels[k], 7, r->local_bins*sizeof(cl_uint), NULL);
+      clSetKernelArg(kernels[k], 8, sizeof(cl_uint), (void *)&r->local_bins);
+      clSetKernelArg(kernels[k], 9, sizeof(cl_uint), (void *)&nx);
+      clSetKernelArg(kernels[k], 10, sizeof(cl_uint), (void *)&ny);
+      if (params->perturbation)
+         clSetKernelArg(kernels[k], 13, sizeof(cl_mem), (void *)&r->orbit_buffer);
+   }
+
+   r->merge_kernel = opencl_get_named_kernel(&r->opencl, "merge_histograms");
+   if (r->merge_kernel == NULL)
+      return false;
+
+   clSetKernelArg(r->merge_kernel, 0, sizeof(cl_mem), (void *)&r->hist_buffer);
+   clSetKernelArg(r->merge_kernel, 1, sizeof(cl_mem), (void *)&r->partial_buffer);
+   clSetKernelArg(r->merge_kernel, 2, sizeof(cl_uint), (void *)&r->n_groups);
+   clSetKernelArg(r->merge_kernel, 3, sizeof(cl_uint), (void *)&r->local_bins);
+
+   return true;
+}
+
+// Set the view of the next frame, and clear the histogram of the previous one unless it
+// is updated by mandelbrot_reuse. These are enqueued behind the previous frame, so they
+// do not need to wait for it.
+static bool renderer_start_frame(renderer* r, const parameters* params, const view* frame, bool clear_histogram) {
+   cl_int opencl_error;
+
+   // With perturbation, the corners are relative to the reference orbit at the centre:
+   // these differences are small, and keep their precision on the device.
+   long double x_ref = 0, y_ref = 0;
+   if (params->perturbation) {
+      size_t real_size = params->fp64 ? sizeof(cl_double) : sizeof(cl_float);
+      cl_uint orbit_n;
+      void* orbit = reference_orbit(params, frame, &orbit_n);
+      if (orbit == NULL)
+         return false;
+      opencl_error = clEnqueueWriteBuffer(r->opencl.queues[0], r->orbit_buffer, CL_TRUE, 0, 2*orbit_n*real_size,
+                                          orbit, 0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+      free(orbit);
+      x_ref = (frame->x[0] + frame->x[1])/2;
+      y_ref = (frame->y[0] + frame->y[1])/2;
+      clSetKernelArg(r->mandelbrot_kernel, 14, sizeof(cl_uint), (void *)&orbit_n);
+      clSetKernelArg(r->reuse_kernel, 14, sizeof(cl_uint), (void *)&orbit_n);
+   }
+   cl_kernel kernels[2] = {r->mandelbrot_kernel, r->reuse_kernel};
+   for (int k = 0; k < 2; k++) {
+      set_real_arg(kernels[k], 1, frame->x[0] - x_ref, params->fp64);
+      set_real_arg(kernels[k], 2, frame->x[1] - x_ref, params->fp64);
+      set_real_arg(kernels[k], 3, frame->y[0] - y_ref, params->fp64);
+      set_real_arg(kernels[k], 4, frame->y[1] - y_ref, params->fp64);
+   }
+
+   if (clear_histogram) {
+      opencl_error = clEnqueueWriteBuffer(r->opencl.queues[0], r->hist_buffer, CL_FALSE, 0,
+                                          params->max_iter*sizeof(cl_uint), r->zero_histogram, 0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+   }
+
+   return true;
+}
+
+static bool renderer_free(renderer* r) {
+   cl_int opencl_error;
+
+   opencl_error = clReleaseMemObject(r->hist_buffer);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clReleaseMemObject(r->partial_buffer);
+   OPENCL_CHECK(opencl_error);
+   if (r->orbit_buffer != NULL) {
+      opencl_error = clReleaseMemObject(r->orbit_buffer);
+      OPENCL_CHECK(opencl_error);
+   }
+   if (r->read_queue != NULL) {
+      for (int i = 0; i < 2; i++) {
+         opencl_error = clReleaseMemObject(r->tile_buffers[i]);
+         OPENCL_CHECK(opencl_error);
+      }
+      opencl_error = clReleaseCommandQueue(r->read_queue);
+      OPENCL_CHECK(opencl_error);
+   }
+   free(r->zero_histogram);
+   if (!opencl_primitives_free(&r->primitives))
+      return false;
+
+   opencl_error = clReleaseProgram(r->program);
+   OPENCL_CHECK(opencl_error);
+
+   return opencl_free(&r->opencl);
+}
 
-   recolor_kernel = opencl_get_named_kernel(&opencl, "recolor");
+
+// Whole frames in one go on a single device, with the histogram scan and the recoloring
+// done on the device as well. The frames are double-buffered: frame N is mapped on a
+// second queue and written out while frame N + 1 is computed. The buffers are allocated
+// in host memory when the device can, so that CPUs and integrated GPUs map them without
+// a copy.
+// The counts of a frame stay on the device for the next one, which reuses them after a
+// pan or a zoom by 2. Three buffers take turns: frame N counts into buffer N % 3 from
+// the counts of frame N - 1, which are then no longer needed, and recolors into those.
+static bool render_frames(renderer* r, const parameters* params, const view* views, uint32_t n_frames) {
+   cl_int opencl_error;
+   cl_kernel recolor_kernel;
+   opencl_launch_config recolor_config;
+   cl_command_queue read_queue;
+   cl_mem data_buffers[3], scan_buffer;
+   cl_mem check_buffers[2] = {NULL, NULL};
+   cl_event read_events[3];
+   cl_event unmap_events[3] = {NULL, NULL, NULL};
+   uint32_t* images[3];
+   int n_buffers = n_frames > 1 ? 3 : 2;
+   size_t data_size = params->dim[0]*params->dim[1]*sizeof(cl_uint);
+   size_t hist_size = params->max_iter*sizeof(cl_uint);
+   size_t merge_size = r->local_bins;
+   cl_uint row0 = 0, ny = params->dim[1];
+
+   recolor_kernel = opencl_get_named_kernel(&r->opencl, "recolor");
    if (recolor_kernel == NULL)
-      return EXIT_FAILURE;
+      return false;
 
-   clSetKernelArg(recolor_kernel, 0, sizeof(cl_mem), (void *)&data_buffer);
-   clSetKernelArg(recolor_kernel, 1, sizeof(cl_mem), (void *)&hist_buffer);
-   clSetKernelArg(recolor_kernel, 2, sizeof(cl_uint), (void *)&params.ncol);
-   opencl_error = clEnqueueNDRangeKernel(opencl.queues[0], recolor_kernel, 2,
-                                         NULL, params.dim, NULL, 0, NULL, NULL);
+   read_queue = clCreateCommandQueue(r->opencl.context, r->opencl.devices[0], 0, &opencl_error);
    OPENCL_CHECK(opencl_error);
 
-   opencl_error = clEnqueueReadBuffer(opencl.queues[0], data_buffer, CL_TRUE, 0, data_size,
-                                      (void*) image, 0, NULL, NULL);
+   for (int b = 0; b < n_buffers; b++) {
+      data_buffers[b] = clCreateBuffer(r->opencl.context, CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, data_size,
+                                       NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+   }
+   // The histogram itself is kept for updating, and scanned in a copy.
+   scan_buffer = clCreateBuffer(r->opencl.context, CL_MEM_READ_WRITE, hist_size, NULL, &opencl_error);
    OPENCL_CHECK(opencl_error);
+   // With -r, reused frames are rendered again in full for comparison, see check_reuse.
+   if (params->check_reuse && n_frames > 1) {
+      check_buffers[0] = clCreateBuffer(r->opencl.context, CL_MEM_READ_WRITE, data_size, NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+      check_buffers[1] = clCreateBuffer(r->opencl.context, CL_MEM_READ_WRITE, hist_size, NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+   }
 
-   if (!write_image(&params, image))
-      return EXIT_FAILURE;
+   clSetKernelArg(r->mandelbrot_kernel, 11, sizeof(cl_uint), (void *)&row0);
+   clSetKernelArg(r->mandelbrot_kernel, 12, sizeof(cl_uint), (void *)&ny);
+   clSetKernelArg(recolor_kernel, 2, sizeof(cl_mem), (void *)&scan_buffer);
+   clSetKernelArg(recolor_kernel, 3, sizeof(cl_uint), (void *)&params->ncol);
+
+   // As with the tiles, frame N waits for buffer b to be unmapped after frame N - 2.
+   for (uint32_t f = 0; f <= n_frames; f++) {
+      int b = f % n_buffers;
+      int previous = (f + n_buffers - 1) % n_buffers;
+
+      if (f < n_frames) {
+         cl_event recolor_event;
+         cl_kernel kernel = r->mandelbrot_kernel;
+         cl_int4 shift;
+         bool reuse = f > 0 && reuse_shift(params, &views[f - 1], &views[f], &shift);
 
-   opencl_error = clReleaseMemObject(data_buffer);
+         if (!renderer_start_frame(r, params, &views[f], !reuse || shift.s[2]))
+            return false;
+
+         if (reuse) {
+            kernel = r->reuse_kernel;
+            clSetKernelArg(kernel, 11, sizeof(cl_mem), (void *)&data_buffers[previous]);
+            clSetKernelArg(kernel, 12, sizeof(cl_int4), (void *)&shift);
+         }
+         clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&data_buffers[b]);
+         opencl_error = clEnqueueNDRangeKernel(r->opencl.queues[0], kernel, 2,
+                                               NULL, r->global_size, r->local_size, unmap_events[b] != NULL,
+                                               unmap_events[b] != NULL ? &unmap_events[b] : NULL, NULL);
+         OPENCL_CHECK(opencl_error);
+         if (unmap_events[b] != NULL) {
+            opencl_error = clReleaseEvent(unmap_events[b]);
+            OPENCL_CHECK(opencl_error);
+            unmap_events[b] = NULL;
+         }
+
+         opencl_error = clEnqueueNDRangeKernel(r->opencl.queues[0], r->merge_kernel, 1,
+                                               NULL, &merge_size, NULL, 0, NULL, NULL);
+         OPENCL_CHECK(opencl_error);
+
+         opencl_error = clEnqueueCopyBuffer(r->opencl.queues[0], r->hist_buffer, scan_buffer, 0, 0, hist_size,
+                                            0, NULL, NULL);
+         OPENCL_CHECK(opencl_error);
+         if (!opencl_scan(&r->primitives, scan_buffer, params->max_iter, OPENCL_UINT, true))
+            return false;
+         if (reuse && check_buffers[0] != NULL && !check_reuse(r, params, data_buffers[b], check_buffers, f))
+            return false;
+
+         clSetKernelArg(recolor_kernel, 0, sizeof(cl_mem), (void *)&data_buffers[previous]);
+         clSetKernelArg(recolor_kernel, 1, sizeof(cl_mem), (void *)&data_buffers[b]);
+         // The local size is tuned once the arguments are set, which is safe as recoloring
+         // again gives the same image. Later runs find it in the cache.
+         if (f == 0 && !opencl_tune_kernel(r->opencl.queues[0], recolor_kernel, 2, params->dim, &recolor_config))
+            return false;
+         opencl_error = clEnqueueNDRangeKernel(r->opencl.queues[0], recolor_kernel, 2,
+                                               NULL, params->dim, opencl_local_size(&recolor_config),
+                                               0, NULL, &recolor_event);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clFlush(r->opencl.queues[0]);
+         OPENCL_CHECK(opencl_error);
+
+         images[previous] = (uint32_t*) clEnqueueMapBuffer(read_queue, data_buffers[previous], CL_FALSE, CL_MAP_READ,
+                                                           0, data_size, 1, &recolor_event, &read_events[previous],
+                                                           &opencl_error);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clFlush(read_queue);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clReleaseEvent(recolor_event);
+         OPENCL_CHECK(opencl_error);
+      }
+
+      // Meanwhile, write out the previous frame, which is in the buffer before that.
+      if (f > 0) {
+         int last = (previous + n_buffers - 1) % n_buffers;
+
+         opencl_error = clWaitForEvents(1, &read_events[last]);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clReleaseEvent(read_events[last]);
+         OPENCL_CHECK(opencl_error);
+
+         char* outfile = frame_name(params, f - 1, n_frames);
+         if (outfile == NULL || !write_image(params, outfile, images[last]))
+            return false;
+         free(outfile);
+
+         opencl_error = clEnqueueUnmapMemObject(read_queue, data_buffers[last], images[last], 0, NULL,
+                                                &unmap_events[last]);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clFlush(read_queue);
+         OPENCL_CHECK(opencl_error);
+      }
+   }
+
+   opencl_error = clFinish(read_queue);
+   OPENCL_CHECK(opencl_error);
+   for (int b = 0; b < n_buffers; b++) {
+      if (unmap_events[b] != NULL) {
+         opencl_error = clReleaseEvent(unmap_events[b]);
+         OPENCL_CHECK(opencl_error);
+      }
+      opencl_error = clReleaseMemObject(data_buffers[b]);
+      OPENCL_CHECK(opencl_error);
+   }
+   opencl_error = clReleaseMemObject(scan_buffer);
    OPENCL_CHECK(opencl_error);
-   opencl_error = clReleaseMemObject(hist_buffer);
+   for (int i = 0; i < 2; i++) {
+      if (check_buffers[i] != NULL) {
+         opencl_error = clReleaseMemObject(check_buffers[i]);
+         OPENCL_CHECK(opencl_error);
+      }
+   }
+   opencl_error = clReleaseCommandQueue(read_queue);
    OPENCL_CHECK(opencl_error);
 
-   free(image);
-   free(histogram);
-   free(params.outfile);
+   return true;
+}
+
+// Whether frame can reuse the counts of previous: the same pixel size and a pan by a whole
+// number of pixels, or half the pixel size and the pixels of previous on every other one.
+// The shift is in the pixels of frame, see mandelbrot_reuse. Pixels off by less than a
+// thousandth of a pixel count as the same.
+static bool reuse_shift(const parameters* params, const view* previous, const view* frame, cl_int4* shift) {
+   const long double tolerance = 1e-3;
+   long double step[2], scale[2], offset[2];
+   int zoom = -1;
+
+   for (int i = 0; i < 2; i++) {
+      const long double* a = i == 0 ? previous->x : previous->y;
+      const long double* b = i == 0 ? frame->x : frame->y;
+      long double n = params->dim[i] - 1;
+
+      step[i]   = (b[1] - b[0])/n;
+      scale[i]  = (a[1] - a[0])/n/step[i];
+      offset[i] = (b[0] - a[0])/step[i];
+   }
+
+   for (int z = 0; z < 2; z++) {
+      if (fabsl(scale[0] - (z + 1)) < tolerance/params->dim[0] && fabsl(scale[1] - (z + 1)) < tolerance/params->dim[1])
+         zoom = z;
+   }
+   if (zoom < 0)
+      return false;
+
+   for (int i = 0; i < 2; i++) {
+      long double pixels = roundl(offset[i]);
+      if (fabsl(offset[i] - pixels) > tolerance || fabsl(pixels) >= (zoom + 1)*params->dim[i])
+         return false;
+      shift->s[i] = pixels;
+   }
+   shift->s[2] = zoom;
+   shift->s[3] = 0;
+
+   return true;
+}
+
+// Render the view of a reused frame again with the mandelbrot kernel into check_buffers[0],
+// and report how many of its counts differ from the reused ones. They may: a reused count
+// was computed at the c of the pixel in the previous view, which is rounded differently
+// from its c in this one. The render also counts into the histogram, which is saved in
+// check_buffers[1] and restored, and its partial histograms are overwritten by the next frame.
+static bool check_reuse(renderer* r, const parameters* params, cl_mem counts, cl_mem check_buffers[2], uint32_t frame) {
+   cl_int opencl_error;
+   size_t n_pixels = params->dim[0]*params->dim[1];
+   size_t hist_size = params->max_iter*sizeof(cl_uint);
+   size_t differ = 0;
 
-   opencl_error = clReleaseProgram(program);
+   opencl_error = clEnqueueCopyBuffer(r->opencl.queues[0], r->hist_buffer, check_buffers[1], 0, 0, hist_size,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+   clSetKernelArg(r->mandelbrot_kernel, 0, sizeof(cl_mem), (void *)&check_buffers[0]);
+   opencl_error = clEnqueueNDRangeKernel(r->opencl.queues[0], r->mandelbrot_kernel, 2,
+                                         NULL, r->global_size, r->local_size, 0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clEnqueueCopyBuffer(r->opencl.queues[0], check_buffers[1], r->hist_buffer, 0, 0, hist_size,
+                                      0, NULL, NULL);
    OPENCL_CHECK(opencl_error);
 
-   if (!opencl_free(&opencl))
-      return EXIT_FAILURE;
+   uint32_t* reused = (uint32_t*) malloc(n_pixels*sizeof(uint32_t));
+   uint32_t* full = (uint32_t*) malloc(n_pixels*sizeof(uint32_t));
+   if (reused == NULL || full == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   opencl_error = clEnqueueReadBuffer(r->opencl.queues[0], counts, CL_TRUE, 0, n_pixels*sizeof(uint32_t), reused,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clEnqueueReadBuffer(r->opencl.queues[0], check_buffers[0], CL_TRUE, 0, n_pixels*sizeof(uint32_t),
+                                      full, 0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
 
-   return EXIT_SUCCESS;
+   for (size_t i = 0; i < n_pixels; i++) {
+      if (reused[i] != full[i])
+         differ++;
+   }
+   printf("Frame %u: %zu of %zu reused counts differ from a full render\n", frame, differ, n_pixels);
+   free(reused);
+   free(full);
+
+   return true;
 }
 
-static bool prefix_sum(opencl_handle* opencl, cl_mem buffer, cl_uint buffer_n) {
-   // Inclusive prefix scan on the buffer (of uints)
-   size_t block_size, nblocks, global_size;
-   size_t wg_size = 1;
+// Work-group and global sizes of the mandelbrot kernel, and the number of histogram bins
+// that fit in local memory. With strips, a row has fewer work-items.
+static bool histogram_layout(opencl_handle* opencl, cl_kernel kernel, const parameters* params,
+                             cl_uint vector_width, size_t* local_size, size_t* global_size, cl_uint* local_bins) {
+   size_t wg_size;
+   cl_ulong local_mem_size, kernel_local_mem;
+   cl_uint compute_units;
    cl_int opencl_error;
-   cl_mem sums_buffer;
-   cl_kernel scan_kernel;
 
-   // divide data into blocks of size <= 2*max_work_group_size
-   opencl_error = clGetDeviceInfo(opencl->devices[0], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &block_size, NULL);
+   opencl_error = clGetKernelWorkGroupInfo(kernel, opencl->devices[0], CL_KERNEL_WORK_GROUP_SIZE,
+                                           sizeof(size_t), &wg_size, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clGetKernelWorkGroupInfo(kernel, opencl->devices[0], CL_KERNEL_LOCAL_MEM_SIZE,
+                                           sizeof(cl_ulong), &kernel_local_mem, NULL);
    OPENCL_CHECK(opencl_error);
-   // Max work group size is always a power of 2 in practice, but let's pretend we don't know that
-   // We need a power of 2 that is at most as large as max wg size
-   while (wg_size < block_size)
-      wg_size *= 2;
-   if (wg_size > block_size)
-      wg_size /= 2;
-   // Each thread can handle two elements on the first round
-   block_size = 2*wg_size;
-
-   // Round up to a multiple of block_size
-   nblocks = (buffer_n + block_size - 1) / block_size;
-   global_size = nblocks * wg_size;
-
-   if (nblocks > 1) {
-      sums_buffer = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE, nblocks*sizeof(cl_uint), NULL, &opencl_error);
+   opencl_error = clGetDeviceInfo(opencl->devices[0], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong),
+                                  &local_mem_size, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clGetDeviceInfo(opencl->devices[0], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint),
+                                  &compute_units, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   // Up to 16 x 16 work-items, powers of two
+   local_size[0] = 16;
+   while (local_size[0] > wg_size)
+      local_size[0] /= 2;
+   local_size[1] = 1;
+   while (local_size[1] < 16 && 2*local_size[1]*local_size[0] <= wg_size)
+      local_size[1] *= 2;
+
+   size_t work_items[2] = {params->dim[0], params->dim[1]};
+   if (vector_width > 0)
+      work_items[0] = (work_items[0] + vector_width - 1) / vector_width;
+
+   // A few work-groups for each compute unit, so that the device stays busy while some of
+   // them finish their pixels early. The grid is about square, unless the image is too
+   // narrow or short to need it.
+   size_t needed[2], groups[2];
+   for (int i = 0; i < 2; i++)
+      needed[i] = (work_items[i] + local_size[i] - 1) / local_size[i];
+   size_t target = GROUPS_PER_COMPUTE_UNIT*compute_units;
+   groups[0] = 1;
+   while (groups[0]*groups[0] < target)
+      groups[0]++;
+   if (groups[0] > needed[0])
+      groups[0] = needed[0];
+   groups[1] = (target + groups[0] - 1) / groups[0];
+   if (groups[1] > needed[1])
+      groups[1] = needed[1];
+   groups[0] = (target + groups[1] - 1) / groups[1];
+   if (groups[0] > needed[0])
+      groups[0] = needed[0];
+   for (int i = 0; i < 2; i++)
+      global_size[i] = groups[i]*local_size[i];
+
+   // Half of the local memory, so that more than one work-group fits on a compute unit.
+   // The counts beyond go to the global histogram with atomics.
+   cl_ulong free_local_mem = local_mem_size > kernel_local_mem ? local_mem_size - kernel_local_mem : 0;
+   *local_bins = free_local_mem/2 / sizeof(cl_uint);
+   if (*local_bins > params->max_iter)
+      *local_bins = params->max_iter;
+
+   return true;
+}
+
+// Scalar arguments of the mandelbrot kernel follow its precision.
+static void set_real_arg(cl_kernel kernel, cl_uint index, long double value, bool fp64) {
+   if (fp64) {
+      cl_double arg = value;
+      clSetKernelArg(kernel, index, sizeof(cl_double), (void *)&arg);
+   } else {
+      cl_float arg = value;
+      clSetKernelArg(kernel, index, sizeof(cl_float), (void *)&arg);
+   }
+}
+
+// Reference orbit for the perturbation mode, at the centre of the frame. It is computed
+// in long double, which sets the limit of the zoom depth, and stored in the precision of
+// the kernel. The orbit ends at MAX_ITER iterations or where it escapes.
+static void* reference_orbit(const parameters* params, const view* frame, cl_uint* orbit_n) {
+   size_t real_size = params->fp64 ? sizeof(cl_double) : sizeof(cl_float);
+   long double cx = (frame->x[0] + frame->x[1])/2;
+   long double cy = (frame->y[0] + frame->y[1])/2;
+   long double zx = 0, zy = 0, tmp;
+   cl_uint n = 0;
+
+   void* orbit = malloc(2*(params->max_iter + 1)*real_size);
+   if (orbit == NULL) {
+      printf("Out of memory!\n");
+      return NULL;
+   }
+
+   while (true) {
+      if (params->fp64) {
+         ((cl_double*) orbit)[2*n]     = zx;
+         ((cl_double*) orbit)[2*n + 1] = zy;
+      } else {
+         ((cl_float*) orbit)[2*n]     = zx;
+         ((cl_float*) orbit)[2*n + 1] = zy;
+      }
+      n++;
+
+      if (n > params->max_iter || zx*zx + zy*zy >= 4)
+         break;
+      tmp = zx*zx - zy*zy + cx;
+      zy  = 2*zx*zy + cy;
+      zx  = tmp;
+   }
+
+   *orbit_n = n;
+   return orbit;
+}
+
+// Rows per tile: the -t option, otherwise the whole image on a single device, and enough
+// tiles for balancing the load on several devices. Tiles are limited to the smallest
+// single buffer allowed on the devices.
+static bool tile_layout(renderer* renderers, uint32_t n_renderers, const parameters* params, size_t* tile_rows) {
+   cl_ulong max_alloc, device_max_alloc;
+   cl_int opencl_error;
+   size_t row_size = params->dim[0]*sizeof(cl_uint);
+
+   max_alloc = ~(cl_ulong) 0;
+   for (uint32_t d = 0; d < n_renderers; d++) {
+      opencl_error = clGetDeviceInfo(renderers[d].opencl.devices[0], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong),
+                                     &device_max_alloc, NULL);
       OPENCL_CHECK(opencl_error);
-   } else
-      sums_buffer = NULL;
+      if (device_max_alloc < max_alloc)
+         max_alloc = device_max_alloc;
+   }
+
+   if (params->tile_rows > 0)
+      *tile_rows = params->tile_rows;
+   else if (n_renderers == 1)
+      *tile_rows = params->dim[1];
+   else
+      *tile_rows = (params->dim[1] + 16*n_renderers - 1) / (16*n_renderers);
+
+   if (*tile_rows > max_alloc / row_size)
+      *tile_rows = max_alloc / row_size;
+   if (*tile_rows > params->dim[1])
+      *tile_rows = params->dim[1];
 
-   scan_kernel = opencl_get_named_kernel(opencl, "scan");
-   if (scan_kernel == NULL)
+   if (*tile_rows == 0) {
+      printf("A single row of the image does not fit on the device!\n");
       return false;
+   }
+
+   return true;
+}
 
-   clSetKernelArg(scan_kernel, 0, sizeof(cl_mem), (void *)&buffer);
-   clSetKernelArg(scan_kernel, 1, sizeof(cl_mem), (void *)&sums_buffer);
-   clSetKernelArg(scan_kernel, 2, block_size*sizeof(cl_uint), NULL);
-   clSetKernelArg(scan_kernel, 3, sizeof(cl_uint), (void*)&buffer_n);
+// Same as the recolor kernel, for images that are recolored on the host. The scanned
+// histogram is 64-bit, as tiled images may have more than 2^32 pixels.
+static void recolor_tile(uint32_t* tile, size_t n, const uint64_t* histogram, const parameters* params) {
+   float scaling = ((float) params->ncol) / histogram[params->max_iter - 1];
 
-   opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], scan_kernel, 1, NULL, &global_size, &wg_size, 0, NULL, NULL);
-   OPENCL_CHECK(opencl_error);
+   // Rounded half away from zero as round() in the kernel, not by adding a half, which
+   // differs at ties such as 0.49999997f + 0.5f == 1.0f.
+   for (size_t i = 0; i < n; i++) {
+      if (tile[i] > 0)
+         tile[i] = roundf(histogram[tile[i] - 1]*scaling);
+   }
+}
 
-   if (nblocks > 1) {
-      clSetKernelArg(scan_kernel, 0, sizeof(cl_mem), (void *)&sums_buffer);
-      clSetKernelArg(scan_kernel, 1, sizeof(cl_mem), NULL);
-      clSetKernelArg(scan_kernel, 2, block_size*sizeof(cl_uint), NULL);
-      clSetKernelArg(scan_kernel, 3, sizeof(cl_uint), (void*)&nblocks);
+// Render tiles from the queue on one device until it runs out. Two tiles are in flight:
+// while one is computed on the queue of the device, the previous one is mapped on a
+// second queue and written out. The queue and the buffers are kept in the renderer for
+// the next frames.
+static bool render_tiles(renderer* r, tile_queue* tiles) {
+   const parameters* params = tiles->params;
+   cl_int opencl_error;
+   cl_command_queue read_queue;
+   cl_mem* tile_buffers = r->tile_buffers;
+   cl_event read_events[2];
+   cl_event unmap_events[2] = {NULL, NULL};
+   uint32_t* host_tiles[2];
+   cl_uint ny = params->dim[1];
+   size_t row_size = params->dim[0]*sizeof(cl_uint);
+   size_t merge_size = r->local_bins;
+   size_t tile_rows = tiles->tile_rows;
+   size_t pending = 0;
+   bool have_pending = false;
+   int b = 0;
 
-      // Single WG should be enough for this, unless we want to get overly fancy with recursive calls
-      opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], scan_kernel, 1, NULL, &wg_size, &wg_size, 0, NULL, NULL);
+   if (r->read_queue == NULL) {
+      r->read_queue = clCreateCommandQueue(r->opencl.context, r->opencl.devices[0], 0, &opencl_error);
       OPENCL_CHECK(opencl_error);
 
-      cl_kernel add_kernel = opencl_get_named_kernel(opencl, "add_totals");
-      if (add_kernel == NULL)
+      for (int i = 0; i < 2; i++) {
+         tile_buffers[i] = clCreateBuffer(r->opencl.context, CL_MEM_WRITE_ONLY|CL_MEM_ALLOC_HOST_PTR, tile_rows*row_size,
+                                          NULL, &opencl_error);
+         OPENCL_CHECK(opencl_error);
+      }
+   }
+   read_queue = r->read_queue;
+
+   // The next tile goes to buffer b, once the tile before last has been unmapped from it.
+   while (true) {
+      size_t t = atomic_fetch_add(&tiles->next, 1);
+
+      if (t < tiles->n_tiles) {
+         cl_event kernel_event;
+         cl_uint row0 = t*tile_rows;
+         cl_uint rows = ny - row0 < tile_rows ? ny - row0 : tile_rows;
+
+         clSetKernelArg(r->mandelbrot_kernel, 0, sizeof(cl_mem), (void *)&tile_buffers[b]);
+         clSetKernelArg(r->mandelbrot_kernel, 11, sizeof(cl_uint), (void *)&row0);
+         clSetKernelArg(r->mandelbrot_kernel, 12, sizeof(cl_uint), (void *)&rows);
+
+         opencl_error = clEnqueueNDRangeKernel(r->opencl.queues[0], r->mandelbrot_kernel, 2,
+                                               NULL, r->global_size, r->local_size, unmap_events[b] != NULL,
+                                               unmap_events[b] != NULL ? &unmap_events[b] : NULL, &kernel_event);
+         OPENCL_CHECK(opencl_error);
+         if (unmap_events[b] != NULL) {
+            opencl_error = clReleaseEvent(unmap_events[b]);
+            OPENCL_CHECK(opencl_error);
+            unmap_events[b] = NULL;
+         }
+         opencl_error = clEnqueueNDRangeKernel(r->opencl.queues[0], r->merge_kernel, 1,
+                                               NULL, &merge_size, NULL, 0, NULL, NULL);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clFlush(r->opencl.queues[0]);
+         OPENCL_CHECK(opencl_error);
+
+         host_tiles[b] = (uint32_t*) clEnqueueMapBuffer(read_queue, tile_buffers[b], CL_FALSE, CL_MAP_READ, 0,
+                                                        rows*row_size, 1, &kernel_event, &read_events[b],
+                                                        &opencl_error);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clFlush(read_queue);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clReleaseEvent(kernel_event);
+         OPENCL_CHECK(opencl_error);
+      }
+
+      // Meanwhile, write out the previous tile.
+      if (have_pending) {
+         size_t rows = ny - pending*tile_rows < tile_rows ? ny - pending*tile_rows : tile_rows;
+         off_t offset = pending*tile_rows*row_size;
+
+         opencl_error = clWaitForEvents(1, &read_events[1 - b]);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clReleaseEvent(read_events[1 - b]);
+         OPENCL_CHECK(opencl_error);
+
+         if (pwrite(tiles->out_fd, host_tiles[1 - b], rows*row_size, offset) != (ssize_t) (rows*row_size)) {
+            printf("Writing output file '%s' failed!\n", tiles->outfile);
+            return false;
+         }
+
+         opencl_error = clEnqueueUnmapMemObject(read_queue, tile_buffers[1 - b], host_tiles[1 - b], 0, NULL,
+                                                &unmap_events[1 - b]);
+         OPENCL_CHECK(opencl_error);
+         opencl_error = clFlush(read_queue);
+         OPENCL_CHECK(opencl_error);
+      }
+
+      if (t >= tiles->n_tiles)
+         break;
+      pending = t;
+      have_pending = true;
+      b = 1 - b;
+   }
+
+   opencl_error = clFinish(read_queue);
+   OPENCL_CHECK(opencl_error);
+   for (int i = 0; i < 2; i++) {
+      if (unmap_events[i] != NULL) {
+         opencl_error = clReleaseEvent(unmap_events[i]);
+         OPENCL_CHECK(opencl_error);
+      }
+   }
+
+   return true;
+}
+
+typedef struct {
+   renderer* r;
+   tile_queue* tiles;
+   bool success;
+} render_thread_args;
+
+static void* render_thread(void* arg) {
+   render_thread_args* args = (render_thread_args*) arg;
+   args->success = render_tiles(args->r, args->tiles);
+   return NULL;
+}
+
+// Render the image in tiles of tile_rows rows that are streamed to the output file. Each
+// device is driven by a host thread of its own, and takes the next tile from the shared
+// queue whenever it is done with one, so faster devices simply render more tiles.
+// The histograms of the devices are summed up once all tiles are done, and the file is
+// recolored in a second pass. A raw image is recolored in place, other formats are
+// encoded from a temporary file of the tiles next to the output.
+static bool render_tiled(renderer* renderers, uint32_t n_renderers, const parameters* params, size_t tile_rows,
+                         const char* outfile) {
+   cl_int opencl_error;
+   tile_queue tiles;
+   image_writer writer;
+   bool raw = image_format_of(outfile) == IMAGE_RAW;
+   char* tile_file = NULL;
+   pthread_t* threads;
+   render_thread_args* thread_args;
+   uint32_t *device_histogram, *tile;
+   uint64_t* histogram;
+   size_t row_size = params->dim[0]*sizeof(cl_uint);
+   bool success = true;
+
+   tiles.params = params;
+   tiles.tile_rows = tile_rows;
+   tiles.n_tiles = (params->dim[1] + tile_rows - 1) / tile_rows;
+   atomic_init(&tiles.next, 0);
+   if (raw)
+      tiles.outfile = outfile;
+   else if (asprintf(&tile_file, "%s.tiles", outfile) >= 0)
+      tiles.outfile = tile_file;
+   else {
+      printf("Out of memory!\n");
+      return false;
+   }
+   tiles.out_fd = open(tiles.outfile, O_RDWR|O_CREAT|O_TRUNC, 0644);
+   if (tiles.out_fd < 0) {
+      printf("Creating output file '%s' failed!\n", tiles.outfile);
+      return false;
+   }
+
+   threads = (pthread_t*) malloc(n_renderers*sizeof(pthread_t));
+   thread_args = (render_thread_args*) malloc(n_renderers*sizeof(render_thread_args));
+   histogram = (uint64_t*) calloc(params->max_iter, sizeof(uint64_t));
+   device_histogram = (uint32_t*) malloc(params->max_iter*sizeof(uint32_t));
+   tile = (uint32_t*) malloc(tile_rows*row_size);
+   if (threads == NULL || thread_args == NULL || histogram == NULL || device_histogram == NULL || tile == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   for (uint32_t d = 0; d < n_renderers; d++) {
+      thread_args[d].r = &renderers[d];
+      thread_args[d].tiles = &tiles;
+      if (pthread_create(&threads[d], NULL, render_thread, &thread_args[d]) != 0) {
+         printf("Creating a thread failed!\n");
          return false;
-      clSetKernelArg(add_kernel, 0, sizeof(cl_mem), (void *)&buffer);
-      clSetKernelArg(add_kernel, 1, sizeof(cl_mem), (void *)&sums_buffer);
-      clSetKernelArg(add_kernel, 2, sizeof(cl_uint), (void*)&buffer_n);
-      opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], add_kernel, 1, NULL, &global_size, &wg_size, 0, NULL, NULL);
-      OPENCL_CHECK(opencl_error);
+      }
+   }
+   for (uint32_t d = 0; d < n_renderers; d++) {
+      pthread_join(threads[d], NULL);
+      success = success && thread_args[d].success;
+   }
+   if (!success)
+      return false;
 
-      opencl_error = clReleaseMemObject(sums_buffer);
+   // Now the histogram is complete: sum up the devices, and scan. The bins of each device
+   // are 32-bit, but the total only fits in 64 bits for the largest images.
+   for (uint32_t d = 0; d < n_renderers; d++) {
+      opencl_error = clEnqueueReadBuffer(renderers[d].opencl.queues[0], renderers[d].hist_buffer, CL_TRUE, 0,
+                                         params->max_iter*sizeof(cl_uint), (void*) device_histogram, 0, NULL, NULL);
       OPENCL_CHECK(opencl_error);
+      for (cl_uint i = 0; i < params->max_iter; i++)
+         histogram[i] += device_histogram[i];
+   }
+   for (cl_uint i = 1; i < params->max_iter; i++)
+      histogram[i] += histogram[i - 1];
+
+   if (!raw && !image_open(&writer, params, outfile))
+      return false;
+
+   for (size_t t = 0; t < tiles.n_tiles; t++) {
+      size_t rows = params->dim[1] - t*tile_rows < tile_rows ? params->dim[1] - t*tile_rows : tile_rows;
+      size_t size = rows*row_size;
+      off_t offset = t*tile_rows*row_size;
+
+      if (pread(tiles.out_fd, tile, size, offset) != (ssize_t) size) {
+         printf("Reading back output file '%s' failed!\n", tiles.outfile);
+         return false;
+      }
+      recolor_tile(tile, rows*params->dim[0], histogram, params);
+      if (!raw) {
+         if (!image_write_rows(&writer, tile, rows))
+            return false;
+      } else if (pwrite(tiles.out_fd, tile, size, offset) != (ssize_t) size) {
+         printf("Writing output file '%s' failed!\n", outfile);
+         return false;
+      }
    }
 
+   close(tiles.out_fd);
+   if (!raw) {
+      if (!image_close(&writer))
+         return false;
+      unlink(tile_file);
+      free(tile_file);
+   }
+   free(threads);
+   free(thread_args);
+   free(histogram);
+   free(device_histogram);
+   free(tile);
+
    return true;
 }
+
+// The host backend, without OpenCL. The escape time is computed in strips as wide as
+// the vectors of the processor, with the same arithmetic as the kernels.
+#if defined(__x86_64__) || defined(__i386__)
+// As in mandelbrot.cl
+#define NATIVE_MULTIPLIER_LIMIT 0.99f
+
+#define SIMD_TARGET "avx"
+#define SIMD_NAME(f) f ## _avx_float
+#define SIMD_REAL float
+#define SIMD_WIDTH 8
+#define SIMD_VECTOR __m256
+#define SIMD(op) _mm256_ ## op ## _ps
+#define SIMD_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define SIMD_EQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#include "mandelbrot_simd.h"
+
+#define SIMD_TARGET "avx"
+#define SIMD_NAME(f) f ## _avx_double
+#define SIMD_REAL double
+#define SIMD_WIDTH 4
+#define SIMD_VECTOR __m256d
+#define SIMD(op) _mm256_ ## op ## _pd
+#define SIMD_LT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define SIMD_EQ(a, b) _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+#include "mandelbrot_simd.h"
+
+#define SIMD_TARGET "sse2"
+#define SIMD_NAME(f) f ## _sse_float
+#define SIMD_REAL float
+#define SIMD_WIDTH 4
+#define SIMD_VECTOR __m128
+#define SIMD(op) _mm_ ## op ## _ps
+#define SIMD_LT(a, b) _mm_cmplt_ps(a, b)
+#define SIMD_EQ(a, b) _mm_cmpeq_ps(a, b)
+#include "mandelbrot_simd.h"
+
+#define SIMD_TARGET "sse2"
+#define SIMD_NAME(f) f ## _sse_double
+#define SIMD_REAL double
+#define SIMD_WIDTH 2
+#define SIMD_VECTOR __m128d
+#define SIMD(op) _mm_ ## op ## _pd
+#define SIMD_LT(a, b) _mm_cmplt_pd(a, b)
+#define SIMD_EQ(a, b) _mm_cmpeq_pd(a, b)
+#include "mandelbrot_simd.h"
+#endif
+
+#define NATIVE_MAX_WIDTH 8
+
+typedef void (*strip_function)(const parameters* params, const view* frame, uint32_t px, uint32_t py,
+                               uint32_t* counters);
+
+// A frame on the host. The threads take the next row whenever they are done with one.
+typedef struct {
+   const parameters* params;
+   const view* frame;
+   strip_function strip;
+   uint32_t width;
+   atomic_size_t next_row;
+   uint32_t* image;
+} native_frame;
+
+typedef struct {
+   native_frame* frame;
+   uint32_t* histogram;
+} native_thread_args;
+
+static void* native_thread(void* arg) {
+   native_thread_args* args = (native_thread_args*) arg;
+   native_frame* frame = args->frame;
+   const parameters* params = frame->params;
+   uint32_t nx = params->dim[0];
+   uint32_t counters[NATIVE_MAX_WIDTH];
+
+   while (true) {
+      size_t py = atomic_fetch_add(&frame->next_row, 1);
+      if (py >= params->dim[1])
+         break;
+
+      for (uint32_t px = 0; px < nx; px += frame->width) {
+         frame->strip(params, frame->frame, px, py, counters);
+         for (uint32_t i = 0; i < frame->width && px + i < nx; i++) {
+            frame->image[py*nx + px + i] = counters[i];
+            if (counters[i] < params->max_iter)
+               args->histogram[counters[i]]++;
+         }
+      }
+   }
+
+   return NULL;
+}
+
+// Render the frames on the host, with a thread per processor (or -n of them). Each thread
+// keeps a histogram of its own, and they are summed up and scanned once the frame is done.
+// There is no perturbation or subdivision here, the iteration is always the direct one.
+static bool render_native(const parameters* params, const view* views, uint32_t n_frames) {
+   native_frame frame;
+   pthread_t* threads;
+   native_thread_args* thread_args;
+   uint32_t* histograms;
+   uint64_t* histogram;
+   const char* instructions;
+   size_t n_pixels = params->dim[0]*params->dim[1];
+   long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+   uint32_t n_threads = n_processors > 0 ? n_processors : 1;
+
+   if (params->max_devices > 0 && params->max_devices < n_threads)
+      n_threads = params->max_devices;
+
+#if defined(__x86_64__) || defined(__i386__)
+   if (__builtin_cpu_supports("avx")) {
+      frame.strip = params->fp64 ? strip_escape_time_avx_double : strip_escape_time_avx_float;
+      frame.width = params->fp64 ? 4 : 8;
+      instructions = "AVX";
+   } else {
+      frame.strip = params->fp64 ? strip_escape_time_sse_double : strip_escape_time_sse_float;
+      frame.width = params->fp64 ? 2 : 4;
+      instructions = "SSE2";
+   }
+#else
+   printf("Rendering on the host needs an x86 processor!\n");
+   return false;
+#endif
+   printf("Rendering on the host with %u threads, %s strips of %u pixels\n", n_threads, instructions, frame.width);
+   if (params->perturbation || params->subdivision)
+      printf("Perturbation and subdivision are only done with OpenCL\n");
+
+   frame.params = params;
+   frame.image = (uint32_t*) malloc(n_pixels*sizeof(uint32_t));
+   threads = (pthread_t*) malloc(n_threads*sizeof(pthread_t));
+   thread_args = (native_thread_args*) malloc(n_threads*sizeof(native_thread_args));
+   histograms = (uint32_t*) malloc((size_t) n_threads*params->max_iter*sizeof(uint32_t));
+   histogram = (uint64_t*) malloc(params->max_iter*sizeof(uint64_t));
+   if (frame.image == NULL || threads == NULL || thread_args == NULL || histograms == NULL || histogram == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   for (uint32_t f = 0; f < n_frames; f++) {
+      frame.frame = &views[f];
+      atomic_init(&frame.next_row, 0);
+      memset(histograms, 0, (size_t) n_threads*params->max_iter*sizeof(uint32_t));
+
+      for (uint32_t t = 0; t < n_threads; t++) {
+         thread_args[t].frame = &frame;
+         thread_args[t].histogram = histograms + (size_t) t*params->max_iter;
+         if (pthread_create(&threads[t], NULL, native_thread, &thread_args[t]) != 0) {
+            printf("Creating a thread failed!\n");
+            return false;
+         }
+      }
+      for (uint32_t t = 0; t < n_threads; t++)
+         pthread_join(threads[t], NULL);
+
+      for (cl_uint i = 0; i < params->max_iter; i++) {
+         histogram[i] = i > 0 ? histogram[i - 1] : 0;
+         for (uint32_t t = 0; t < n_threads; t++)
+            histogram[i] += thread_args[t].histogram[i];
+      }
+      recolor_tile(frame.image, n_pixels, histogram, params);
+
+      char* outfile = frame_name(params, f, n_frames);
+      if (outfile == NULL || !write_image(params, outfile, frame.image))
+         return false;
+      free(outfile);
+   }
+
+   free(frame.image);
+   free(threads);
+   free(thread_args);
+   free(histograms);
+   free(histogram);
+
+   return true;
+}
+
+// Rendering time since start, without the setup
+static void print_throughput(const parameters* params, uint32_t n_frames, const struct timespec* start) {
+   struct timespec end;
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   double seconds = (end.tv_sec - start->tv_sec) + 1e-9*(end.tv_nsec - start->tv_nsec);
+   printf("Rendered %u frame%s in %.3f s, %.1f Mpixels/s\n", n_frames, n_frames > 1 ? "s" : "", seconds,
+          1e-6*n_frames*params->dim[0]*params->dim[1]/seconds);
+}
+
+// Views of the frames. A single frame shows the -x/-y view. A sequence moves through
+// the keyframes of the -k file, one "x_lo x_hi y_lo y_hi" per line, or without one zooms
+// into the centre of the -x/-y view by the factor -z. Between two keyframes, the centre
+// moves linearly and the size changes geometrically, for a steady zoom speed.
+static view* sequence_views(const parameters* params, uint32_t* n_frames) {
+   view* keyframes;
+   view* views;
+   uint32_t n_keyframes = 0;
+
+   *n_frames = params->frames > 0 ? params->frames : 1;
+   views = (view*) malloc(*n_frames*sizeof(view));
+   if (views == NULL) {
+      printf("Out of memory!\n");
+      return NULL;
+   }
+
+   if (params->keyfile != NULL) {
+      uint32_t capacity = 16;
+      view key;
+      FILE* key_fid = fopen(params->keyfile, "r");
+      if (key_fid == NULL) {
+         printf("Opening keyframe file '%s' failed!\n", params->keyfile);
+         return NULL;
+      }
+      keyframes = (view*) malloc(capacity*sizeof(view));
+      while (keyframes != NULL && fscanf(key_fid, "%Lf %Lf %Lf %Lf", &key.x[0], &key.x[1], &key.y[0], &key.y[1]) == 4) {
+         if (n_keyframes == capacity) {
+            capacity *= 2;
+            keyframes = (view*) realloc(keyframes, capacity*sizeof(view));
+            if (keyframes == NULL)
+               break;
+         }
+         keyframes[n_keyframes++] = key;
+      }
+      fclose(key_fid);
+      if (keyframes == NULL) {
+         printf("Out of memory!\n");
+         return NULL;
+      }
+      if (n_keyframes == 0) {
+         printf("No keyframes in '%s'!\n", params->keyfile);
+         return NULL;
+      }
+   } else {
+      long double cx = (params->x[0] + params->x[1])/2;
+      long double cy = (params->y[0] + params->y[1])/2;
+      n_keyframes = 2;
+      keyframes = (view*) malloc(n_keyframes*sizeof(view));
+      if (keyframes == NULL) {
+         printf("Out of memory!\n");
+         return NULL;
+      }
+      for (int i = 0; i < 2; i++) {
+         keyframes[0].x[i] = params->x[i];
+         keyframes[0].y[i] = params->y[i];
+         keyframes[1].x[i] = cx + (params->x[i] - cx)/params->zoom;
+         keyframes[1].y[i] = cy + (params->y[i] - cy)/params->zoom;
+      }
+   }
+
+   for (uint32_t f = 0; f < *n_frames; f++) {
+      long double s = *n_frames > 1 ? (long double) f*(n_keyframes - 1)/(*n_frames - 1) : 0;
+      uint32_t k = s;
+      if (k + 1 >= n_keyframes) {
+         views[f] = keyframes[n_keyframes - 1];
+         continue;
+      }
+      long double t = s - k;
+      const view* a = &keyframes[k];
+      const view* b = &keyframes[k + 1];
+
+      long double cx = (1 - t)*(a->x[0] + a->x[1])/2 + t*(b->x[0] + b->x[1])/2;
+      long double cy = (1 - t)*(a->y[0] + a->y[1])/2 + t*(b->y[0] + b->y[1])/2;
+      long double w  = (a->x[1] - a->x[0])*powl((b->x[1] - b->x[0])/(a->x[1] - a->x[0]), t);
+      long double h  = (a->y[1] - a->y[0])*powl((b->y[1] - b->y[0])/(a->y[1] - a->y[0]), t);
+      views[f].x[0] = cx - w/2;
+      views[f].x[1] = cx + w/2;
+      views[f].y[0] = cy - h/2;
+      views[f].y[1] = cy + h/2;
+   }
+
+   free(keyframes);
+   return views;
+}
+
+// Output file of a frame: the -o name for a single frame, and the frame number inserted
+// before the extension for a sequence, as in mandelbrot_0001.raw.
+static char* frame_name(const parameters* params, uint32_t frame, uint32_t n_frames) {
+   char* name = NULL;
+   const char* extension = strrchr(params->outfile, '.');
+   const char* directory = strrchr(params->outfile, '/');
+
+   if (extension == NULL || (directory != NULL && extension < directory))
+      extension = params->outfile + strlen(params->outfile);
+
+   if (n_frames == 1)
+      name = strdup(params->outfile);
+   else if (asprintf(&name, "%.*s_%04u%s", (int) (extension - params->outfile), params->outfile,
+                     frame, extension) < 0)
+      name = NULL;
+
+   if (name == NULL)
+      printf("Out of memory!\n");
+   return name;
+}
+
+static image_format image_format_of(const char* outfile) {
+   const char* extension = strrchr(outfile, '.');
+
+   if (extension != NULL && strcasecmp(extension, ".ppm") == 0)
+      return IMAGE_PPM;
+   if (extension != NULL && strcasecmp(extension, ".png") == 0)
+      return IMAGE_PNG;
+   return IMAGE_RAW;
+}
+
+static void put_be32(uint8_t* p, uint32_t value) {
+   p[0] = value >> 24;
+   p[1] = value >> 16;
+   p[2] = value >> 8;
+   p[3] = value;
+}
+
+// A PNG chunk: length, type, data and the CRC of type and data. The type is in the first
+// four bytes of data, as zlib computes the CRC in one go then.
+static bool png_chunk(image_writer* writer, const uint8_t* data, uint32_t length) {
+   uint8_t length_bytes[4], crc_bytes[4];
+
+   put_be32(length_bytes, length);
+   put_be32(crc_bytes, crc32(0, data, length + 4));
+   return fwrite(length_bytes, 4, 1, writer->file) == 1 && fwrite(data, length + 4, 1, writer->file) == 1 &&
+          fwrite(crc_bytes, 4, 1, writer->file) == 1;
+}
+
+// The compressed data so far, as an IDAT chunk
+#define PNG_CHUNK_SIZE (1 << 16)
+
+static bool png_flush(image_writer* writer) {
+   uint32_t length = PNG_CHUNK_SIZE - writer->stream.avail_out;
+
+   if (length > 0 && !png_chunk(writer, writer->chunk, length))
+      return false;
+   writer->stream.next_out  = writer->chunk + 4;
+   writer->stream.avail_out = PNG_CHUNK_SIZE;
+   return true;
+}
+
+// Colours 1 ... ncol go from dark blue through green and orange to black, as does 0.
+static void palette_init(uint8_t (*palette)[3], cl_uint ncol) {
+   for (cl_uint i = 0; i <= ncol; i++) {
+      float t = ncol > 0 ? (float) i / ncol : 0;
+      palette[i][0] = 255*9.0f*(1 - t)*t*t*t;
+      palette[i][1] = 255*15.0f*(1 - t)*(1 - t)*t*t;
+      palette[i][2] = 255*8.5f*(1 - t)*(1 - t)*(1 - t)*t;
+   }
+}
+
+static bool image_open(image_writer* writer, const parameters* params, const char* outfile) {
+   size_t nx = params->dim[0], ny = params->dim[1];
+
+   memset(writer, 0, sizeof(image_writer));
+   writer->params = params;
+   writer->name = outfile;
+   writer->format = image_format_of(outfile);
+   writer->file = fopen(outfile, "w");
+   if (writer->file == NULL) {
+      printf("Creating output file '%s' failed!\n", outfile);
+      return false;
+   }
+   if (writer->format == IMAGE_RAW)
+      return true;
+
+   // The PNG rows start with the filter type, which is 0 for none.
+   writer->palette = malloc((params->ncol + 1)*sizeof(*writer->palette));
+   writer->row = (uint8_t*) calloc(1 + 3*nx, 1);
+   if (writer->palette == NULL || writer->row == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   palette_init(writer->palette, params->ncol);
+
+   if (writer->format == IMAGE_PPM) {
+      if (fprintf(writer->file, "P6\n%zu %zu\n255\n", nx, ny) < 0) {
+         printf("Writing output file '%s' failed!\n", outfile);
+         return false;
+      }
+      return true;
+   }
+
+   // 8-bit RGB, no interlacing
+   static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+   uint8_t header[4 + 13] = {'I', 'H', 'D', 'R'};
+   put_be32(header + 4, nx);
+   put_be32(header + 8, ny);
+   header[12] = 8;
+   header[13] = 2;
+
+   writer->chunk = (uint8_t*) malloc(4 + PNG_CHUNK_SIZE);
+   if (writer->chunk == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   memcpy(writer->chunk, "IDAT", 4);
+   if (deflateInit(&writer->stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   writer->stream.next_out  = writer->chunk + 4;
+   writer->stream.avail_out = PNG_CHUNK_SIZE;
+
+   if (fwrite(signature, sizeof(signature), 1, writer->file) != 1 || !png_chunk(writer, header, 13)) {
+      printf("Writing output file '%s' failed!\n", outfile);
+      return false;
+   }
+   return true;
+}
+
+// The next rows of the image, recolored
+static bool image_write_rows(image_writer* writer, const uint32_t* data, size_t rows) {
+   size_t nx = writer->params->dim[0];
+   cl_uint ncol = writer->params->ncol;
+   uint8_t* rgb = writer->row + 1;
+
+   if (writer->format == IMAGE_RAW) {
+      if (fwrite(data, rows*nx*sizeof(uint32_t), 1, writer->file) != 1) {
+         printf("Writing output file '%s' failed!\n", writer->name);
+         return false;
+      }
+      return true;
+   }
+
+   for (size_t y = 0; y < rows; y++) {
+      for (size_t x = 0; x < nx; x++) {
+         uint32_t colour = data[y*nx + x] < ncol ? data[y*nx + x] : ncol;
+         memcpy(rgb + 3*x, writer->palette[colour], 3);
+      }
+
+      if (writer->format == IMAGE_PPM) {
+         if (fwrite(rgb, 3*nx, 1, writer->file) != 1) {
+            printf("Writing output file '%s' failed!\n", writer->name);
+            return false;
+         }
+         continue;
+      }
+
+      writer->stream.next_in  = writer->row;
+      writer->stream.avail_in = 1 + 3*nx;
+      while (writer->stream.avail_in > 0) {
+         if (writer->stream.avail_out == 0 && !png_flush(writer)) {
+            printf("Writing output file '%s' failed!\n", writer->name);
+            return false;
+         }
+         deflate(&writer->stream, Z_NO_FLUSH);
+      }
+   }
+
+   return true;
+}
+
+static bool image_close(image_writer* writer) {
+   bool success = true;
+
+   if (writer->format == IMAGE_PNG) {
+      int status;
+      do {
+         status = deflate(&writer->stream, Z_FINISH);
+         success = success && png_flush(writer);
+      } while (status == Z_OK);
+      deflateEnd(&writer->stream);
+      success = success && status == Z_STREAM_END && png_chunk(writer, (const uint8_t*) "IEND", 0);
+      free(writer->chunk);
+   }
+   free(writer->palette);
+   free(writer->row);
+
+   if (fclose(writer->file) != 0)
+      success = false;
+   if (!success)
+      printf("Writing output file '%s' failed!\n", writer->name);
+   return success;
+}
@@ -1,117 +1,379 @@
+#ifdef MANDELBROT_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 complex;
+#else
+typedef float real;
 // Let's try this way, see if it breaks
 typedef float2 complex;
+#endif
 
-__kernel void mandelbrot(__global uint* image, float x0, float x1, float y0, float y1,
-                         __global uint* histogram) {
-  complex c;
-  complex z = (complex)(0.0f, 0.0f);
-  float tmp; // for storing new z.x while still calculating z.y
 
-  uint px = get_global_id(0);
-  uint py = get_global_id(1);
-  uint counter = 0;
+// Points well inside the main cardioid or the period-2 bulb never escape: there the
+// attracting fixed point (or 2-cycle) has a multiplier below 1 in magnitude, 1 - sqrt(1 - 4c)
+// for the cardioid and 4(c + 1) for the bulb. The limit keeps the test away from the
+// boundary, where rounding could still let the iteration escape.
+#define MULTIPLIER_LIMIT 0.99f
 
-  // Will no longer work if round the size up to a multiple of 32!
-  uint nx = get_global_size(0);
-  uint ny = get_global_size(1);
+bool in_main_components(complex c) {
+   real a = 1 - 4*c.x;
+   real b = -4*c.y;
+   real m = sqrt(a*a + b*b);
+   // sqrt(1 - 4c)
+   real sx = sqrt((m + a)/2);
+   real sy = copysign(sqrt((m - a)/2), b);
 
-  c.x = (x1*px + x0*(nx - 1 - px))/(nx - 1);
-  c.y = (y1*py + y0*(ny - 1 - py))/(ny - 1);
+   if ((1 - sx)*(1 - sx) + sy*sy < MULTIPLIER_LIMIT*MULTIPLIER_LIMIT)
+      return true;
+   return 16*((c.x + 1)*(c.x + 1) + c.y*c.y) < MULTIPLIER_LIMIT*MULTIPLIER_LIMIT;
+}
 
-  while(z.x*z.x + z.y*z.y < 4 && counter < MAX_ITER) {
-     tmp = z.x*z.x - z.y*z.y + c.x;
-     z.y = 2.0f*z.x*z.y + c.y;
-     z.x = tmp;
-     counter++;
-  }
+// Number of iterations before z escapes, or MAX_ITER.
+// z is compared to a saved value, which is moved forward at powers of two (Brent). If
+// the iteration gets back to exactly the same z, it is in a cycle that never escapes, so
+// the result is the same as iterating all the way.
+uint escape_time(complex c) {
+   complex z = 0;
+   complex saved = 0;
+   real tmp; // for storing new z.x while still calculating z.y
+   uint counter = 0;
+   uint period = 1;
 
-  image[py*nx + px] = counter;
+   if (in_main_components(c))
+      return MAX_ITER;
 
-  // This is a terrible idea, most counts go to the first bins and we serialize the access
-  // using atomic ops. But histograms are hard, I don't want to put too much effort there now.
-  if (counter < MAX_ITER)
-     atomic_inc(&histogram[counter]);
-}
+   while(z.x*z.x + z.y*z.y < 4 && counter < MAX_ITER) {
+      tmp = z.x*z.x - z.y*z.y + c.x;
+      z.y = 2*z.x*z.y + c.y;
+      z.x = tmp;
+      counter++;
 
+      if (z.x == saved.x && z.y == saved.y)
+         return MAX_ITER;
+      if (counter == period) {
+         saved = z;
+         period *= 2;
+      }
+   }
 
-// Parallel (inclusive) prefix sum, following GPU gems & some lecture notes
-__kernel void scan(__global uint* data, __global uint* sums, __local uint* workspace, uint data_size) {
-   uint thread_id = get_local_id(0);
-   uint scan_size = get_local_size(0);
-   uint offset = 2*scan_size*get_group_id(0);
+   return counter;
+}
 
-   data = data + offset;
-   data_size = min(data_size - offset, 2*scan_size);
+// Same with perturbation theory: z = Z + dz, where Z is the reference orbit of orbit_n
+// points computed on the host at high precision, and dc is the offset from its c.
+// dz is rebased to the start of the orbit when z gets closer to zero than dz (which
+// would lose its precision) or the orbit runs out.
+uint perturbed_escape_time(complex dc, __global const complex* orbit, uint orbit_n) {
+   complex dz = 0;
+   complex z  = 0;
+   real tmp;
+   uint m = 0;
+   uint counter = 0;
 
-   // Fetch data to workspace
-   while (thread_id < data_size) {
-      workspace[thread_id] = data[thread_id];
-      thread_id += scan_size;
-   }
-   // In the last WG we may have some empty workspace:
-   while (thread_id < 2*scan_size) {
-      workspace[thread_id] = 0;
-      thread_id += scan_size;
-   }
-   thread_id = get_local_id(0);
-
-   // Reduction
-   offset = 1;
-   for (int d = scan_size; d > 0; d >>= 1) {
-      barrier(CLK_LOCAL_MEM_FENCE);
-      if (thread_id < d) {
-         int ai = offset*(2*thread_id + 1) - 1;
-         int bi = ai + offset;
-         workspace[bi] += workspace[ai];
+   while(z.x*z.x + z.y*z.y < 4 && counter < MAX_ITER) {
+      // dz = (2Z + dz)*dz + dc
+      complex a = 2*orbit[m] + dz;
+      tmp  = a.x*dz.x - a.y*dz.y + dc.x;
+      dz.y = a.x*dz.y + a.y*dz.x + dc.y;
+      dz.x = tmp;
+      m++;
+      counter++;
+
+      z = orbit[m] + dz;
+      if (z.x*z.x + z.y*z.y < dz.x*dz.x + dz.y*dz.y || m == orbit_n - 1) {
+         dz = z;
+         m  = 0;
       }
-      offset <<= 1;
    }
 
-   // Build the complete scan
-   offset = scan_size >> 1;
-   for (int d = 2; d <= scan_size; d <<= 1) {
-      barrier(CLK_LOCAL_MEM_FENCE);
-      if (thread_id + 1 < d ) {
-         int ai = offset*(2*thread_id + 2) - 1;
-         int bi = ai + offset;
-         workspace[bi] += workspace[ai];
+   return counter;
+}
+
+// The perturbed iteration is not a function of z alone, so it has no periodicity check.
+#ifdef PERTURBATION
+#define ESCAPE_TIME(c) perturbed_escape_time(c, orbit, orbit_n)
+#else
+#define ESCAPE_TIME(c) escape_time(c)
+#endif
+
+// The point of pixel (px, py) in the view.
+complex pixel_c(uint px, uint py, real x0, real x1, real y0, real y1, uint nx, uint ny) {
+   complex c;
+
+   c.x = (x1*px + x0*(nx - 1 - px))/(nx - 1);
+   c.y = (y1*py + y0*(ny - 1 - py))/(ny - 1);
+
+   return c;
+}
+
+#ifdef VECTOR_WIDTH
+// CPU devices vectorize over work-items poorly when each one has a loop of its own
+// length, so with VECTOR_WIDTH each work-item computes a strip of that many pixels of
+// a row in vector registers. The lanes iterate together until all have escaped or
+// found a cycle, masked so that each lane follows the iteration of escape_time. The
+// counts may still differ from escape_time near the boundary: the compiler may contract
+// the vector and the scalar code to fused multiply-adds differently, and the vector
+// division and square root need not round like the scalar ones.
+#ifdef PERTURBATION
+#error "The strips have no perturbed iteration"
+#endif
+#define VECTOR_(type, n) type ## n
+#define VECTOR(type, n) VECTOR_(type, n)
+#ifdef MANDELBROT_DOUBLE
+typedef VECTOR(double, VECTOR_WIDTH) realv;
+typedef VECTOR(long, VECTOR_WIDTH) maskv;
+#else
+typedef VECTOR(float, VECTOR_WIDTH) realv;
+typedef VECTOR(int, VECTOR_WIDTH) maskv;
+#endif
+#define vload_real VECTOR(vload, VECTOR_WIDTH)
+#define vstore_uint VECTOR(vstore, VECTOR_WIDTH)
+#define convert_uintv VECTOR(convert_uint, VECTOR_WIDTH)
+
+// in_main_components for each lane
+maskv strip_in_main_components(realv cx, realv cy) {
+   realv a = 1 - 4*cx;
+   realv b = -4*cy;
+   realv m = sqrt(a*a + b*b);
+   realv sx = sqrt((m + a)/2);
+   realv sy = copysign(sqrt((m - a)/2), b);
+
+   return ((1 - sx)*(1 - sx) + sy*sy < MULTIPLIER_LIMIT*MULTIPLIER_LIMIT) |
+          (16*((cx + 1)*(cx + 1) + cy*cy) < MULTIPLIER_LIMIT*MULTIPLIER_LIMIT);
+}
+
+// escape_time of the pixels px ... px + VECTOR_WIDTH - 1 of row py, into counters. The lanes
+// still iterating all have the same count, so the periodicity check can share the period.
+void strip_escape_time(uint px, uint py, real x0, real x1, real y0, real y1, uint nx, uint ny,
+                       uint* counters) {
+   real lanes[VECTOR_WIDTH];
+   for (uint i = 0; i < VECTOR_WIDTH; i++)
+      lanes[i] = px + i;
+   realv pxv = vload_real(0, lanes);
+   realv cx  = (x1*pxv + x0*((real)(nx - 1) - pxv))/(nx - 1);
+   realv cy  = pixel_c(px, py, x0, x1, y0, y1, nx, ny).y;
+
+   realv zx = 0, zy = 0;
+   realv saved_x = 0, saved_y = 0;
+   realv tmp;
+   maskv n = 0;
+   maskv cycle  = strip_in_main_components(cx, cy);
+   maskv active = ~cycle;
+   uint counter = 0;
+   uint period = 1;
+
+   while (counter < MAX_ITER) {
+      active &= zx*zx + zy*zy < 4;
+      if (!any(active))
+         break;
+
+      tmp = zx*zx - zy*zy + cx;
+      zy  = select(zy, 2*zx*zy + cy, active);
+      zx  = select(zx, tmp, active);
+      // true is -1
+      n -= active;
+      counter++;
+
+      maskv repeat = active & (zx == saved_x) & (zy == saved_y);
+      cycle  |= repeat;
+      active &= ~repeat;
+      if (counter == period) {
+         saved_x = zx;
+         saved_y = zy;
+         period *= 2;
       }
-      offset >>= 1;
    }
 
-   barrier(CLK_LOCAL_MEM_FENCE);
+   vstore_uint(convert_uintv(select(n, (maskv)MAX_ITER, cycle)), 0, counters);
+}
+#endif
 
-   if (sums && thread_id == 0)
-      sums[get_group_id(0)] = workspace[2*scan_size - 1];
+// Add a count to the work-group histogram, or to the global one beyond local_bins.
+void count(uint counter, __local uint* local_histogram, uint local_bins, __global uint* histogram) {
+   if (counter < local_bins)
+      atomic_inc(&local_histogram[counter]);
+   else if (counter < MAX_ITER)
+      atomic_inc(&histogram[counter]);
+}
 
-   while (thread_id < data_size) {
-      data[thread_id] = workspace[thread_id];
-      thread_id += scan_size;
-   }
+// Take a count of the previous frame out of the histogram, see mandelbrot_reuse.
+void uncount(uint counter, __global uint* histogram) {
+   if (counter < MAX_ITER)
+      atomic_dec(&histogram[counter]);
 }
 
+// Each work-group counts the iterations of its pixels in a private histogram in local
+// memory, and writes it out to partial_histograms for merge_histograms. Only the first
+// local_bins bins fit there when MAX_ITER is large, the rest go directly to the global
+// histogram: most counts land in the first bins, so the global atomics are rare.
+// The work-groups loop over the image, so that the number of partial histograms stays small.
+// Only the rows row0 ... row0 + rows - 1 of the ny rows are computed, into the start of image.
+// With PERTURBATION, x0 ... y1 are relative to the c of the reference orbit.
+// With MARIANI_SILVER, each work-group takes blocks of its own size. The border of a block
+// is computed first, and if it has a single count, so does the inside, which is filled in
+// without iterating. This holds as the set and the bands of equal count have no holes,
+// but features thinner than a pixel may be missed: unlike the rest, this is not exact.
+// With VECTOR_WIDTH, the work-items take strips of VECTOR_WIDTH pixels, see strip_escape_time.
+__kernel void mandelbrot(__global uint* image, real x0, real x1, real y0, real y1,
+                         __global uint* histogram, __global uint* partial_histograms,
+                         __local uint* local_histogram, uint local_bins, uint nx, uint ny,
+                         uint row0, uint rows
+#ifdef PERTURBATION
+                         , __global const complex* orbit, uint orbit_n
+#endif
+                         ) {
+  uint thread_id = get_local_id(1)*get_local_size(0) + get_local_id(0);
+  uint wg_size   = get_local_size(0)*get_local_size(1);
 
-// Add the totals of each workgroup to data
-__kernel void add_totals(__global uint* data, __global const uint* sums, uint data_size) {
-   uint thread_id = get_local_id(0);
-   uint scan_size = get_local_size(0);
-   uint group     = get_group_id(0);
-
-   if (group > 0) {
-      uint to_add = sums[group];
-      uint offset = group*2*scan_size + thread_id;
-      if (offset < data_size)
-         data[offset] += to_add;
-      offset += scan_size;
-      if (offset < data_size)
-         data[offset] += to_add;
-   }
+  for (uint i = thread_id; i < local_bins; i += wg_size)
+     local_histogram[i] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+#ifdef MARIANI_SILVER
+  __local uint block_min, block_max;
+  uint bw = get_local_size(0);
+  uint bh = get_local_size(1);
+
+  for (uint by = get_group_id(1)*bh; by < rows; by += get_num_groups(1)*bh) {
+     for (uint bx = get_group_id(0)*bw; bx < nx; bx += get_num_groups(0)*bw) {
+        uint px = bx + get_local_id(0);
+        uint py = by + get_local_id(1);
+        uint last_x = min(bx + bw, nx) - 1;
+        uint last_y = min(by + bh, rows) - 1;
+        bool inside = px <= last_x && py <= last_y;
+        bool border = inside && (px == bx || py == by || px == last_x || py == last_y);
+        uint counter = 0;
+
+        if (thread_id == 0) {
+           block_min = MAX_ITER;
+           block_max = 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (border) {
+           counter = ESCAPE_TIME(pixel_c(px, row0 + py, x0, x1, y0, y1, nx, ny));
+           atomic_min(&block_min, counter);
+           atomic_max(&block_max, counter);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (inside && !border) {
+           if (block_min == block_max)
+              counter = block_min;
+           else
+              counter = ESCAPE_TIME(pixel_c(px, row0 + py, x0, x1, y0, y1, nx, ny));
+        }
+        if (inside) {
+           image[py*nx + px] = counter;
+           count(counter, local_histogram, local_bins, histogram);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+     }
+  }
+#elif defined(VECTOR_WIDTH)
+  for (uint py = get_global_id(1); py < rows; py += get_global_size(1)) {
+     for (uint px = VECTOR_WIDTH*get_global_id(0); px < nx; px += VECTOR_WIDTH*get_global_size(0)) {
+        uint counters[VECTOR_WIDTH];
+        strip_escape_time(px, row0 + py, x0, x1, y0, y1, nx, ny, counters);
+
+        for (uint i = 0; i < VECTOR_WIDTH && px + i < nx; i++) {
+           image[py*nx + px + i] = counters[i];
+           count(counters[i], local_histogram, local_bins, histogram);
+        }
+     }
+  }
+#else
+  for (uint py = get_global_id(1); py < rows; py += get_global_size(1)) {
+     for (uint px = get_global_id(0); px < nx; px += get_global_size(0)) {
+        uint counter = ESCAPE_TIME(pixel_c(px, row0 + py, x0, x1, y0, y1, nx, ny));
+
+        image[py*nx + px] = counter;
+        count(counter, local_histogram, local_bins, histogram);
+     }
+  }
+#endif
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+  uint group = get_group_id(1)*get_num_groups(0) + get_group_id(0);
+  for (uint i = thread_id; i < local_bins; i += wg_size)
+     partial_histograms[group*local_bins + i] = local_histogram[i];
+}
+
+
+// The next frame of a sequence, from the counts of the previous frame where they can be
+// reused. After a pan by shift.x, shift.y pixels, the pixel (px, py) was at
+// (px + shift.x, py + shift.y). With shift.z set, after a zoom by exactly 2, it was at
+// half of that if both are even. Only the other pixels are computed.
+// After a pan, histogram still has the previous frame: each exposed pixel takes the place
+// of the dropped one at its wrapped-around position, whose count is taken out. After a
+// zoom, three quarters of the pixels are new anyway, and all of them are counted.
+// A reused count was computed at the c of the pixel in the previous view, which pixel_c
+// rounds differently from its c in this one, and with PERTURBATION from another reference
+// orbit, so near the boundary reused pixels may differ from a full render of the frame.
+// mandelbrot -r reports how many do.
+__kernel void mandelbrot_reuse(__global uint* image, real x0, real x1, real y0, real y1,
+                               __global uint* histogram, __global uint* partial_histograms,
+                               __local uint* local_histogram, uint local_bins, uint nx, uint ny,
+                               __global const uint* previous, int4 shift
+#ifdef PERTURBATION
+                               , __global const complex* orbit, uint orbit_n
+#endif
+                               ) {
+  uint thread_id = get_local_id(1)*get_local_size(0) + get_local_id(0);
+  uint wg_size   = get_local_size(0)*get_local_size(1);
+
+  for (uint i = thread_id; i < local_bins; i += wg_size)
+     local_histogram[i] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint py = get_global_id(1); py < ny; py += get_global_size(1)) {
+     for (uint px = get_global_id(0); px < nx; px += get_global_size(0)) {
+        int sx = (int)px + shift.x;
+        int sy = (int)py + shift.y;
+        uint counter;
+
+        if (shift.z) {
+           if (sx >= 0 && sy >= 0 && !(sx & 1) && !(sy & 1) && sx/2 < (int)nx && sy/2 < (int)ny)
+              counter = previous[(sy/2)*nx + sx/2];
+           else
+              counter = ESCAPE_TIME(pixel_c(px, py, x0, x1, y0, y1, nx, ny));
+           count(counter, local_histogram, local_bins, histogram);
+        } else if (sx >= 0 && sy >= 0 && sx < (int)nx && sy < (int)ny) {
+           counter = previous[sy*nx + sx];
+        } else {
+           uncount(previous[((sy + ny) % ny)*nx + (sx + nx) % nx], histogram);
+           counter = ESCAPE_TIME(pixel_c(px, py, x0, x1, y0, y1, nx, ny));
+           count(counter, local_histogram, local_bins, histogram);
+        }
+        image[py*nx + px] = counter;
+     }
+  }
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+  uint group = get_group_id(1)*get_num_groups(0) + get_group_id(0);
+  for (uint i = thread_id; i < local_bins; i += wg_size)
+     partial_histograms[group*local_bins + i] = local_histogram[i];
 }
 
 
-// Recolor the image using the cumulative histogram. This just global memory read/write,
-// and would indeed be better left to host.
-__kernel void recolor(__global uint* image, __global const uint* histogram, uint ncol) {
+// Sum the partial histograms of the work-groups into the histogram, one bin per thread.
+__kernel void merge_histograms(__global uint* histogram, __global const uint* partial_histograms,
+                               uint n_partial, uint bins) {
+   uint bin = get_global_id(0);
+   uint sum = 0;
+
+   if (bin >= bins)
+      return;
+
+   for (uint group = 0; group < n_partial; group++)
+      sum += partial_histograms[group*bins + bin];
+   histogram[bin] += sum;
+}
+
+
+// Recolor the counts into image using the cumulative histogram. This just global memory
+// read/write, and would indeed be better left to host.
+__kernel void recolor(__global uint* image, __global const uint* counts, __global const uint* histogram, uint ncol) {
    uint px = get_global_id(0);
    uint py = get_global_id(1);
    uint nx = get_global_size(0);
@@ -120,10 +382,10 @@ __kernel void recolor(__global uint* image, __global const uint* histogram, uint
    // Each thread does the same, expensive division, but we don't really care for now.
    float scaling = ((float)ncol ) / total;
 
-   uint old_val = image[py*nx + px];
+   uint old_val = counts[py*nx + px];
    // In the set = 0, everything else will be recolored
-   if (old_val > 0) {
-      uint new_val = round(histogram[old_val - 1]*scaling);
-      image[py*nx + px] = new_val;
-   }
+   if (old_val > 0)
+      image[py*nx + px] = round(histogram[old_val - 1]*scaling);
+   else
+      image[py*nx + px] = 0;
 }
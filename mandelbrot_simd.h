@@ -0,0 +1,100 @@
+// The escape time of a strip of pixels on the host, for render_native in mandelbrot.c.
+// This is included once per instruction set and precision, with
+//   SIMD_TARGET     the target attribute of the functions
+//   SIMD_NAME(f)    the name of the function f for this variant
+//   SIMD_REAL       float or double
+//   SIMD_WIDTH      lanes in a vector
+//   SIMD_VECTOR     the vector type
+//   SIMD(op)        the intrinsic for op, as in SIMD(add)
+//   SIMD_LT, SIMD_EQ  comparisons giving all-ones masks
+// and they are undefined at the end. The arithmetic is the same as in the escape_time and
+// strip_escape_time kernels, but the counts may still differ from a device near the
+// boundary: OpenCL may contract to fused multiply-adds, and its single precision division
+// and square root need not be correctly rounded, while the host rounds every operation.
+
+// Lanes of b where mask is set, of a elsewhere
+__attribute__((target(SIMD_TARGET)))
+static inline SIMD_VECTOR SIMD_NAME(select)(SIMD_VECTOR a, SIMD_VECTOR b, SIMD_VECTOR mask) {
+   return SIMD(or)(SIMD(and)(mask, b), SIMD(andnot)(mask, a));
+}
+
+// escape_time of the pixels px ... px + SIMD_WIDTH - 1 of row py. The counts are kept as
+// reals, which is exact up to 2^24 iterations in single precision.
+__attribute__((target(SIMD_TARGET)))
+static void SIMD_NAME(strip_escape_time)(const parameters* params, const view* frame, uint32_t px, uint32_t py,
+                                         uint32_t* counters) {
+   const SIMD_REAL x0 = frame->x[0], x1 = frame->x[1];
+   const SIMD_REAL y0 = frame->y[0], y1 = frame->y[1];
+   const uint32_t nx = params->dim[0], ny = params->dim[1];
+   const SIMD_VECTOR zero  = SIMD(setzero)();
+   const SIMD_VECTOR one   = SIMD(set1)(1);
+   const SIMD_VECTOR two   = SIMD(set1)(2);
+   const SIMD_VECTOR four  = SIMD(set1)(4);
+   const SIMD_VECTOR sign  = SIMD(set1)(-0.0);
+   const SIMD_VECTOR limit = SIMD(set1)(NATIVE_MULTIPLIER_LIMIT*NATIVE_MULTIPLIER_LIMIT);
+   SIMD_REAL lanes[SIMD_WIDTH];
+
+   for (uint32_t i = 0; i < SIMD_WIDTH; i++)
+      lanes[i] = px + i;
+   SIMD_VECTOR pxv = SIMD(loadu)(lanes);
+   SIMD_VECTOR cx  = SIMD(div)(SIMD(add)(SIMD(mul)(SIMD(set1)(x1), pxv),
+                                         SIMD(mul)(SIMD(set1)(x0), SIMD(sub)(SIMD(set1)(nx - 1), pxv))),
+                               SIMD(set1)(nx - 1));
+   SIMD_VECTOR cy  = SIMD(set1)((y1*py + y0*(ny - 1 - py))/(ny - 1));
+
+   // in_main_components
+   SIMD_VECTOR a  = SIMD(sub)(one, SIMD(mul)(four, cx));
+   SIMD_VECTOR b  = SIMD(mul)(SIMD(set1)(-4), cy);
+   SIMD_VECTOR m  = SIMD(sqrt)(SIMD(add)(SIMD(mul)(a, a), SIMD(mul)(b, b)));
+   SIMD_VECTOR sx = SIMD(sqrt)(SIMD(div)(SIMD(add)(m, a), two));
+   SIMD_VECTOR sy = SIMD(sqrt)(SIMD(div)(SIMD(sub)(m, a), two));
+   sy = SIMD(or)(SIMD(andnot)(sign, sy), SIMD(and)(sign, b));
+   SIMD_VECTOR dx = SIMD(sub)(one, sx);
+   SIMD_VECTOR cardioid = SIMD_LT(SIMD(add)(SIMD(mul)(dx, dx), SIMD(mul)(sy, sy)), limit);
+   SIMD_VECTOR bx = SIMD(add)(cx, one);
+   SIMD_VECTOR bulb = SIMD_LT(SIMD(mul)(SIMD(set1)(16), SIMD(add)(SIMD(mul)(bx, bx), SIMD(mul)(cy, cy))), limit);
+
+   SIMD_VECTOR zx = zero, zy = zero;
+   SIMD_VECTOR saved_x = zero, saved_y = zero;
+   SIMD_VECTOR n = zero;
+   SIMD_VECTOR cycle  = SIMD(or)(cardioid, bulb);
+   SIMD_VECTOR active = SIMD(andnot)(cycle, SIMD_EQ(zero, zero));
+   uint32_t counter = 0;
+   uint32_t period = 1;
+
+   while (counter < params->max_iter) {
+      SIMD_VECTOR zx2 = SIMD(mul)(zx, zx);
+      SIMD_VECTOR zy2 = SIMD(mul)(zy, zy);
+      active = SIMD(and)(active, SIMD_LT(SIMD(add)(zx2, zy2), four));
+      if (SIMD(movemask)(active) == 0)
+         break;
+
+      SIMD_VECTOR tmp = SIMD(add)(SIMD(sub)(zx2, zy2), cx);
+      zy = SIMD_NAME(select)(zy, SIMD(add)(SIMD(mul)(SIMD(mul)(two, zx), zy), cy), active);
+      zx = SIMD_NAME(select)(zx, tmp, active);
+      n  = SIMD(add)(n, SIMD(and)(active, one));
+      counter++;
+
+      SIMD_VECTOR repeat = SIMD(and)(active, SIMD(and)(SIMD_EQ(zx, saved_x), SIMD_EQ(zy, saved_y)));
+      cycle  = SIMD(or)(cycle, repeat);
+      active = SIMD(andnot)(repeat, active);
+      if (counter == period) {
+         saved_x = zx;
+         saved_y = zy;
+         period *= 2;
+      }
+   }
+
+   SIMD(storeu)(lanes, SIMD_NAME(select)(n, SIMD(set1)(params->max_iter), cycle));
+   for (uint32_t i = 0; i < SIMD_WIDTH; i++)
+      counters[i] = lanes[i];
+}
+
+#undef SIMD_TARGET
+#undef SIMD_NAME
+#undef SIMD_REAL
+#undef SIMD_WIDTH
+#undef SIMD_VECTOR
+#undef SIMD
+#undef SIMD_LT
+#undef SIMD_EQ
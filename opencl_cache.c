@@ -0,0 +1,250 @@
+#include "opencl_cache.h"
+
+#include <CL/cl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Start of a file of binaries, followed by the key, the number of devices, the size of
+// the binary of each device and the binaries themselves
+#define BINARY_CACHE_MAGIC "opencl program binaries 1\n"
+
+static char* join_path(const char* dir, const char* name);
+
+
+uint64_t opencl_hash(uint64_t hash, const void* data, size_t size) {
+   const unsigned char* bytes = (const unsigned char*) data;
+   for (size_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+
+char* opencl_cache_path(const char* library, const char* name) {
+   const char* base;
+   char* parent;
+
+   // The directories are created one at a time, and may exist already
+   if ((base = getenv("OPENCL_CACHE_DIR")) != NULL) {
+      if (base[0] == '\0' || (mkdir(base, 0755) != 0 && errno != EEXIST))
+         return NULL;
+      return join_path(base, name);
+   }
+   if ((base = getenv("XDG_CACHE_HOME")) != NULL && base[0] != '\0')
+      parent = join_path(base, "");
+   else if ((base = getenv("HOME")) != NULL)
+      parent = join_path(base, ".cache");
+   else
+      return NULL;
+   if (parent == NULL || (mkdir(parent, 0755) != 0 && errno != EEXIST)) {
+      free(parent);
+      return NULL;
+   }
+
+   char* dir = join_path(parent, library);
+   free(parent);
+   if (dir == NULL || (mkdir(dir, 0755) != 0 && errno != EEXIST)) {
+      free(dir);
+      return NULL;
+   }
+   char* path = join_path(dir, name);
+   free(dir);
+   return path;
+}
+
+
+// The device version and the driver version change with any update of the compiler.
+// The strings are sized by querying them first.
+cl_int opencl_cache_key(cl_uint n_devices, const cl_device_id* devices, cl_uint count, const char** strings,
+                        const size_t* lengths, const char* options, uint64_t* key) {
+   static const cl_device_info identity[4] = {CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION,
+                                              CL_DRIVER_VERSION};
+   cl_int opencl_error;
+   size_t size;
+
+   *key = OPENCL_HASH_INIT;
+   for (cl_uint i = 0; i < count; i++) {
+      size_t length = lengths != NULL && lengths[i] != 0 ? lengths[i] : strlen(strings[i]);
+      *key = opencl_hash(*key, strings[i], length);
+   }
+   if (options == NULL)
+      options = "";
+   *key = opencl_hash(*key, options, strlen(options) + 1);
+
+   for (cl_uint d = 0; d < n_devices; d++) {
+      for (int i = 0; i < 4; i++) {
+         opencl_error = clGetDeviceInfo(devices[d], identity[i], 0, NULL, &size);
+         if (opencl_error != CL_SUCCESS)
+            return opencl_error;
+         char* info = (char*) malloc(size);
+         if (info == NULL)
+            return CL_OUT_OF_HOST_MEMORY;
+         opencl_error = clGetDeviceInfo(devices[d], identity[i], size, info, NULL);
+         if (opencl_error == CL_SUCCESS)
+            *key = opencl_hash(*key, info, size);
+         free(info);
+         if (opencl_error != CL_SUCCESS)
+            return opencl_error;
+      }
+   }
+
+   return CL_SUCCESS;
+}
+
+
+char* opencl_cache_program_path(const char* library, uint64_t key) {
+   char name[64];
+   snprintf(name, sizeof(name), "program-%016" PRIx64 ".bin", key);
+   return opencl_cache_path(library, name);
+}
+
+
+unsigned char* opencl_program_binary(cl_program program, cl_device_id device, size_t* size) {
+   cl_uint n_devices, d = 0;
+   unsigned char* binary = NULL;
+
+   if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &n_devices, NULL) != CL_SUCCESS)
+      return NULL;
+   cl_device_id* devices = (cl_device_id*) malloc(n_devices*sizeof(cl_device_id));
+   size_t* sizes = (size_t*) malloc(n_devices*sizeof(size_t));
+   unsigned char** binaries = (unsigned char**) calloc(n_devices, sizeof(unsigned char*));
+   bool valid = devices != NULL && sizes != NULL && binaries != NULL &&
+                clGetProgramInfo(program, CL_PROGRAM_DEVICES, n_devices*sizeof(cl_device_id), devices,
+                                 NULL) == CL_SUCCESS &&
+                clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, n_devices*sizeof(size_t), sizes,
+                                 NULL) == CL_SUCCESS;
+
+   // Only the binary of the device is copied, the NULL entries are skipped
+   while (valid && d < n_devices && devices[d] != device)
+      d++;
+   valid = valid && d < n_devices && sizes[d] > 0 && (binaries[d] = (unsigned char*) malloc(sizes[d])) != NULL &&
+           clGetProgramInfo(program, CL_PROGRAM_BINARIES, n_devices*sizeof(unsigned char*), binaries,
+                            NULL) == CL_SUCCESS;
+   if (valid) {
+      binary = binaries[d];
+      *size = sizes[d];
+   } else if (binaries != NULL && d < n_devices)
+      free(binaries[d]);
+
+   free(binaries);
+   free(sizes);
+   free(devices);
+   return binary;
+}
+
+
+cl_program opencl_cache_load(cl_context context, cl_uint n_devices, const cl_device_id* devices, const char* path,
+                             uint64_t key, const char* options) {
+   char magic[sizeof(BINARY_CACHE_MAGIC)];
+   uint64_t file_key, size;
+   cl_uint file_devices;
+   cl_program program = NULL;
+   cl_int opencl_error;
+
+   FILE* file = fopen(path, "rb");
+   if (file == NULL)
+      return NULL;
+   size_t* sizes = (size_t*) malloc(n_devices*sizeof(size_t));
+   unsigned char** binaries = (unsigned char**) calloc(n_devices, sizeof(unsigned char*));
+   cl_int* binary_status = (cl_int*) malloc(n_devices*sizeof(cl_int));
+   bool valid = sizes != NULL && binaries != NULL && binary_status != NULL &&
+                fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, BINARY_CACHE_MAGIC, sizeof(magic)) == 0 &&
+                fread(&file_key, sizeof(file_key), 1, file) == 1 && file_key == key &&
+                fread(&file_devices, sizeof(file_devices), 1, file) == 1 && file_devices == n_devices;
+   for (cl_uint d = 0; valid && d < n_devices; d++) {
+      valid = fread(&size, sizeof(size), 1, file) == 1 && size > 0 && size <= SIZE_MAX;
+      sizes[d] = size;
+   }
+   for (cl_uint d = 0; valid && d < n_devices; d++) {
+      binaries[d] = (unsigned char*) malloc(sizes[d]);
+      valid = binaries[d] != NULL && fread(binaries[d], sizes[d], 1, file) == 1;
+   }
+   valid = valid && fgetc(file) == EOF;
+   fclose(file);
+
+   if (valid) {
+      program = clCreateProgramWithBinary(context, n_devices, devices, sizes, (const unsigned char**) binaries,
+                                          binary_status, &opencl_error);
+      if (opencl_error != CL_SUCCESS)
+         program = NULL;
+      else if (clBuildProgram(program, n_devices, devices, options, NULL, NULL) != CL_SUCCESS) {
+         clReleaseProgram(program);
+         program = NULL;
+      }
+   }
+
+   if (binaries != NULL) {
+      for (cl_uint d = 0; d < n_devices; d++)
+         free(binaries[d]);
+   }
+   free(binaries);
+   free(sizes);
+   free(binary_status);
+   return program;
+}
+
+
+// The file is written under a temporary name of its own and renamed, so that threads and
+// programs writing the same key at the same time never read or mix half of it.
+void opencl_cache_store(cl_program program, cl_uint n_devices, const cl_device_id* devices, const char* path,
+                        uint64_t key) {
+   size_t* sizes = (size_t*) calloc(n_devices, sizeof(size_t));
+   unsigned char** binaries = (unsigned char**) calloc(n_devices, sizeof(unsigned char*));
+   bool valid = sizes != NULL && binaries != NULL;
+   for (cl_uint d = 0; valid && d < n_devices; d++) {
+      binaries[d] = opencl_program_binary(program, devices[d], &sizes[d]);
+      valid = binaries[d] != NULL;
+   }
+
+   size_t temporary_size = strlen(path) + sizeof(".XXXXXX");
+   char* temporary = valid ? (char*) malloc(temporary_size) : NULL;
+   FILE* file = NULL;
+   if (temporary != NULL) {
+      snprintf(temporary, temporary_size, "%s.XXXXXX", path);
+      int fd = mkstemp(temporary);
+      if (fd >= 0 && (file = fdopen(fd, "wb")) == NULL) {
+         close(fd);
+         remove(temporary);
+      }
+   }
+   if (file != NULL) {
+      fwrite(BINARY_CACHE_MAGIC, sizeof(BINARY_CACHE_MAGIC), 1, file);
+      fwrite(&key, sizeof(key), 1, file);
+      fwrite(&n_devices, sizeof(n_devices), 1, file);
+      for (cl_uint d = 0; d < n_devices; d++) {
+         uint64_t size = sizes[d];
+         fwrite(&size, sizeof(size), 1, file);
+      }
+      for (cl_uint d = 0; d < n_devices; d++)
+         fwrite(binaries[d], sizes[d], 1, file);
+
+      bool written = !ferror(file);
+      if (fclose(file) != 0 || !written || rename(temporary, path) != 0)
+         remove(temporary);
+   }
+
+   if (binaries != NULL) {
+      for (cl_uint d = 0; d < n_devices; d++)
+         free(binaries[d]);
+   }
+   free(binaries);
+   free(sizes);
+   free(temporary);
+}
+
+
+static char* join_path(const char* dir, const char* name) {
+   size_t size = strlen(dir) + strlen(name) + 2;
+   char* path = (char*) malloc(size);
+   if (path != NULL)
+      snprintf(path, size, "%s/%s", dir, name);
+   return path;
+}
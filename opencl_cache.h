@@ -0,0 +1,94 @@
+/*
+ * Cache of compiled program binaries and other per-device results, shared by
+ * openclutils and owl so that both use the same keys and the same file format.
+ * It only needs OpenCL and the C library.
+ */
+
+#ifndef OPENCL_CACHE_H
+#define OPENCL_CACHE_H
+
+#include <stdint.h>
+#include <CL/cl.h>
+
+#define OPENCL_HASH_INIT 14695981039346656037ULL
+
+/**
+ * 64-bit FNV-1a hash of the data, continuing from an earlier hash, for the keys of the
+ * caches.
+ * @param hash Hash so far, OPENCL_HASH_INIT for the first data.
+ * @param data Data to add to the hash.
+ * @param size Size of the data in bytes.
+ * @return The hash with the data.
+ */
+uint64_t opencl_hash(uint64_t hash, const void* data, size_t size);
+
+/**
+ * Path of a file in the cache directory: $OPENCL_CACHE_DIR if it is set, otherwise a
+ * directory of the library in $XDG_CACHE_HOME or ~/.cache. The directories are created
+ * if needed.
+ * @param library Name of the directory in $XDG_CACHE_HOME or ~/.cache.
+ * @param name File name in the directory.
+ * @return The path, to be freed by the caller, or NULL if there is no cache directory.
+ * An empty OPENCL_CACHE_DIR turns the caches off.
+ */
+char* opencl_cache_path(const char* library, const char* name);
+
+/**
+ * Key of the binaries of a program: a hash of the source, the build options, and the
+ * name, vendor, version and driver version of each device.
+ * @param n_devices Number of devices the program is built for.
+ * @param devices The devices.
+ * @param count Number of source strings.
+ * @param strings Source strings, as for clCreateProgramWithSource.
+ * @param lengths Lengths of the strings, or NULL if they are null-terminated.
+ * @param options Build options, or NULL.
+ * @param key The key.
+ * @return CL_SUCCESS, or the error of a device query.
+ */
+cl_int opencl_cache_key(cl_uint n_devices, const cl_device_id* devices, cl_uint count, const char** strings,
+                        const size_t* lengths, const char* options, uint64_t* key);
+
+/**
+ * Path of the cache file of the binaries of a program, see opencl_cache_path.
+ * @param library Name of the directory in $XDG_CACHE_HOME or ~/.cache.
+ * @param key Key of the program, from opencl_cache_key.
+ * @return The path, to be freed by the caller, or NULL if there is no cache directory.
+ */
+char* opencl_cache_program_path(const char* library, uint64_t key);
+
+/**
+ * Binary of a built program for one of its devices.
+ * @param program The program.
+ * @param device The device.
+ * @param size Size of the binary.
+ * @return The binary, to be freed by the caller, or NULL if there is none.
+ */
+unsigned char* opencl_program_binary(cl_program program, cl_device_id device, size_t* size);
+
+/**
+ * Create and build a program from the binaries in a cache file. A file that does not
+ * match the key exactly, or is cut short, or binaries that the driver rejects are a miss.
+ * @param context Context of the program.
+ * @param n_devices Number of devices to build for.
+ * @param devices The devices, in the order of the key.
+ * @param path The cache file.
+ * @param key Key of the program, from opencl_cache_key.
+ * @param options Build options.
+ * @return The built program, or NULL on a miss.
+ */
+cl_program opencl_cache_load(cl_context context, cl_uint n_devices, const cl_device_id* devices, const char* path,
+                             uint64_t key, const char* options);
+
+/**
+ * Write the binaries of a built program to a cache file. Failures only mean that nothing
+ * is cached, so they are not reported.
+ * @param program The built program.
+ * @param n_devices Number of devices it was built for.
+ * @param devices The devices, in the order of the key.
+ * @param path The cache file.
+ * @param key Key of the program, from opencl_cache_key.
+ */
+void opencl_cache_store(cl_program program, cl_uint n_devices, const cl_device_id* devices, const char* path,
+                        uint64_t key);
+
+#endif
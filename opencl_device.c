@@ -0,0 +1,15 @@
+#include "opencl_device.h"
+
+#include <CL/cl.h>
+#include <stdbool.h>
+
+
+// Devices without double precision report no capabilities, or fail the query before
+// OpenCL 1.2, where CL_DEVICE_DOUBLE_FP_CONFIG was part of cl_khr_fp64.
+bool opencl_device_has_fp64(cl_device_id device) {
+   cl_device_fp_config fp64_config;
+
+   if (clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64_config), &fp64_config, NULL) != CL_SUCCESS)
+      return false;
+   return fp64_config != 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * Queries of device capabilities shared by openclutils and owl.
+ */
+
+#ifndef OPENCL_DEVICE_H
+#define OPENCL_DEVICE_H
+
+#include <stdbool.h>
+#include <CL/cl.h>
+
+/**
+ * Whether the device supports double precision in kernels.
+ * @param device The device.
+ * @return True if kernels for the device can use cl_khr_fp64.
+ */
+bool opencl_device_has_fp64(cl_device_id device);
+
+#endif
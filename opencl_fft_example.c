@@ -1,12 +1,34 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <math.h>
 
 #include "opencl_utils.h"
+#include "opencl_device.h"
 #include "owl/owl_fft.h"
+#include "owl/owl_convolution.h"
 
 #define REAL(z,i) ((z)[2*(i)])
 #define IMAG(z,i) ((z)[2*(i)+1])
 
+#define PI 3.14159265358979323846
+
+// Largest error relative to the norm of the host result, a few hundred times the rounding
+// error of the precision to leave room for the log2(n) passes and Bluestein's three transforms
+#define TOLERANCE(precision) ((precision) == OWL_FFT_SINGLE ? 2e-5 : 1e-12)
+
+// After the example, the transforms of each precision are checked against a naive DFT on
+// the host. The host computes in double, the data is converted to the precision of the
+// handle on the way in and out.
+
+static bool check_transforms(owl_opencl_handle* opencl, owl_fft_precision precision);
+static bool check_complex(owl_fft_handle* handle, size_t n, size_t stride, bool inplace, cl_uint* state);
+static bool check_batch(owl_fft_handle* handle, size_t n, size_t howmany, size_t dist, cl_uint* state);
+static bool check_real(owl_fft_handle* handle, size_t n, cl_uint* state);
+static bool check_nd(owl_fft_handle* handle, cl_uint rank, const size_t* n, cl_uint* state);
+static bool check_convolution(owl_fft_handle* handle, size_t signal_n, size_t filter_n, cl_uint* state);
+
 int main (void)
 {
    int i;
@@ -19,6 +41,7 @@ int main (void)
 
    owl_opencl_handle* opencl_handle;
    owl_fft_handle* fft_handle;
+   owl_fft_complex_wavetable* wavetable;
    owl_fft_complex_workspace* workspace;
 
    for (i = 0; i < n; i++) {
@@ -47,13 +70,19 @@ int main (void)
       return EXIT_FAILURE;
    }
 
-   fft_handle = owl_fft_init(opencl_handle);
+   fft_handle = owl_fft_init(opencl_handle, OWL_FFT_SINGLE);
    if (fft_handle == NULL) {
       printf("OpenCL init failed!\n");
       return EXIT_FAILURE;
    }
 
 
+   wavetable = owl_fft_complex_wavetable_alloc(fft_handle, n);
+   if (wavetable == NULL) {
+      printf("Wavetable allocation failed!\n");
+      return EXIT_FAILURE;
+   }
+
    workspace = owl_fft_complex_workspace_alloc(fft_handle, n);
    if (workspace == NULL) {
       printf("Workspace allocation failed!\n");
@@ -61,18 +90,529 @@ int main (void)
    }
 
    // forward DFT of data
-   owl_fft_complex_forward(fft_handle, data, 1, n, NULL, workspace);
+   owl_fft_complex_forward(fft_handle, data, 1, n, wavetable, workspace);
+
+   for (i = 0; i < n; i++) {
+      printf ("%d: %e %e\n", i, REAL(data, i), IMAG(data, i));
+   }
+   printf ("\n");
+
+   // and back again
+   owl_fft_complex_inverse(fft_handle, data, 1, n, wavetable, workspace);
 
    for (i = 0; i < n; i++) {
       printf ("%d: %e %e\n", i, REAL(data, i), IMAG(data, i));
    }
+   printf ("\n");
 
    owl_fft_complex_workspace_free(workspace);
+   owl_fft_complex_wavetable_free(wavetable);
 
    owl_fft_free(fft_handle);
+
+   bool valid = check_transforms(opencl_handle, OWL_FFT_SINGLE);
+   if (!opencl_device_has_fp64(opencl.devices[0]))
+      printf("Skipping double precision, the device does not support it\n");
+   else
+      valid = check_transforms(opencl_handle, OWL_FFT_DOUBLE) && valid;
+
    owl_opencl_free(opencl_handle);
    // free stuff
    clReleaseContext(context);
 
-   return 0;
+   return valid ? 0 : EXIT_FAILURE;
+}
+
+
+// xorshift32, any fixed sequence will do
+static cl_uint xorshift(cl_uint* state) {
+   *state ^= *state << 13;
+   *state ^= *state >> 17;
+   *state ^= *state << 5;
+   return *state;
+}
+
+// count values in [-1, 1)
+static double* random_values(size_t count, cl_uint* state) {
+   double* x = (double*) malloc(count*sizeof(double));
+   if (x == NULL) {
+      printf("Out of memory!\n");
+      return NULL;
+   }
+   for (size_t i = 0; i < count; i++)
+      x[i] = xorshift(state)/2147483648.0 - 1.0;
+   return x;
+}
+
+// count reals in the precision of the handle
+static void* device_values(const owl_fft_handle* handle, const double* x, size_t count) {
+   void* data = malloc(count*handle->real_size);
+   if (data == NULL) {
+      printf("Out of memory!\n");
+      return NULL;
+   }
+   for (size_t i = 0; i < count; i++) {
+      if (handle->precision == OWL_FFT_SINGLE)
+         ((float*)data)[i] = (float) x[i];
+      else
+         ((double*)data)[i] = x[i];
+   }
+   return data;
+}
+
+static void host_values(const owl_fft_handle* handle, const void* data, double* x, size_t count) {
+   for (size_t i = 0; i < count; i++)
+      x[i] = handle->precision == OWL_FFT_SINGLE ? ((const float*)data)[i] : ((const double*)data)[i];
+}
+
+// Naive DFT of the n complex values at in[stride*t] into out[k], with the sign of the exponent,
+// -1 for the forward transform. Not normalized. The exponents t*k are reduced modulo n
+// exactly, and the roots of unity are computed once.
+static bool host_dft(const double* in, double* out, size_t n, size_t stride, int sign) {
+   double* roots = (double*) malloc(2*n*sizeof(double));
+   if (roots == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   for (size_t j = 0; j < n; j++) {
+      REAL(roots, j) = cos(2*PI*j/n);
+      IMAG(roots, j) = sign*sin(2*PI*j/n);
+   }
+
+   for (size_t k = 0; k < n; k++) {
+      double re = 0, im = 0;
+      for (size_t t = 0; t < n; t++) {
+         size_t j = (t*k) % n;
+         re += REAL(in, t*stride)*REAL(roots, j) - IMAG(in, t*stride)*IMAG(roots, j);
+         im += REAL(in, t*stride)*IMAG(roots, j) + IMAG(in, t*stride)*REAL(roots, j);
+      }
+      REAL(out, k) = re;
+      IMAG(out, k) = im;
+   }
+
+   free(roots);
+   return true;
+}
+
+// DFT along each axis of row-major data of the given shape, in place
+static bool host_dft_nd(double* x, cl_uint rank, const size_t* n, int sign) {
+   size_t size = 1, longest = 1;
+   for (cl_uint a = 0; a < rank; a++) {
+      size *= n[a];
+      if (n[a] > longest)
+         longest = n[a];
+   }
+   double* line = (double*) malloc(2*longest*sizeof(double));
+   if (line == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   size_t inner = size;
+   for (cl_uint a = 0; a < rank; a++) {
+      inner /= n[a];
+      for (size_t start = 0; start < size; start++) {
+         // the first point of each line along the axis
+         if ((start/inner) % n[a] != 0)
+            continue;
+         if (!host_dft(&x[2*start], line, n[a], inner, sign))
+            return false;
+         for (size_t k = 0; k < n[a]; k++) {
+            REAL(x, start + k*inner) = REAL(line, k);
+            IMAG(x, start + k*inner) = IMAG(line, k);
+         }
+      }
+   }
+
+   free(line);
+   return true;
+}
+
+// ||x - y||/||y|| over count reals
+static double relative_error(const double* x, const double* y, size_t count) {
+   double difference = 0, norm = 0;
+   for (size_t i = 0; i < count; i++) {
+      difference += (x[i] - y[i])*(x[i] - y[i]);
+      norm += y[i]*y[i];
+   }
+   return norm > 0 ? sqrt(difference/norm) : sqrt(difference);
+}
+
+static bool within_tolerance(const owl_fft_handle* handle, const char* transform, size_t n, double error) {
+   if (error <= TOLERANCE(handle->precision))
+      return true;
+   printf("%s of %zu points in %s precision differs from the host DFT by %e\n", transform, n,
+          handle->precision == OWL_FFT_SINGLE ? "single" : "double", error);
+   return false;
+}
+
+
+// Powers of two within local memory and beyond it, and Bluestein sizes of which the last
+// needs transforms beyond local memory, each forward and inverse, contiguous, strided and
+// batched, real and multidimensional, and convolutions.
+static bool check_transforms(owl_opencl_handle* opencl, owl_fft_precision precision) {
+   cl_uint state = 2463534242u;
+   bool valid = true;
+
+   owl_fft_handle* handle = owl_fft_init(opencl, precision);
+   if (handle == NULL) {
+      printf("OpenCL init failed!\n");
+      return false;
+   }
+   size_t local_n = handle->max_local_n;
+
+   size_t sizes[12] = {2, 4, 8, 16, 128, local_n, 4*local_n, 3, 7, 100, 1000, local_n + 1};
+   for (int s = 0; s < 12; s++)
+      valid = check_complex(handle, sizes[s], 1, false, &state) && valid;
+   // In place, with a bit reversal pass beyond local memory
+   valid = check_complex(handle, 128, 1, true, &state) && valid;
+   valid = check_complex(handle, 4*local_n, 1, true, &state) && valid;
+   // Small strides are packed on the device, large ones are copied point by point
+   valid = check_complex(handle, 64, 3, false, &state) && valid;
+   valid = check_complex(handle, 100, 2, false, &state) && valid;
+   valid = check_complex(handle, 64, 100, false, &state) && valid;
+
+   valid = check_batch(handle, 256, 5, 260, &state) && valid;
+   valid = check_batch(handle, 100, 3, 100, &state) && valid;
+   valid = check_batch(handle, 4*local_n, 2, 4*local_n, &state) && valid;
+
+   size_t real_sizes[4] = {2, 256, 200, 8*local_n};
+   for (int s = 0; s < 4; s++)
+      valid = check_real(handle, real_sizes[s], &state) && valid;
+
+   size_t square[2] = {16, 32}, bluestein[2] = {12, 10}, cube[3] = {8, 4, 16};
+   valid = check_nd(handle, 2, square, &state) && valid;
+   valid = check_nd(handle, 2, bluestein, &state) && valid;
+   valid = check_nd(handle, 3, cube, &state) && valid;
+
+   valid = check_convolution(handle, 100, 17, &state) && valid;
+   valid = check_convolution(handle, 1, 1, &state) && valid;
+
+   if (valid)
+      printf("Transforms in %s precision match the host DFT\n", precision == OWL_FFT_SINGLE ? "single" : "double");
+   owl_fft_free(handle);
+   return valid;
+}
+
+
+// Forward and inverse transforms of n points at the stride, against the host. The values
+// between the points must come back unchanged.
+static bool check_complex(owl_fft_handle* handle, size_t n, size_t stride, bool inplace, cl_uint* state) {
+   size_t count = 2*((n - 1)*stride + 1);
+   bool valid = true;
+
+   owl_fft_complex_wavetable* wavetable = owl_fft_complex_wavetable_alloc(handle, n);
+   if (wavetable == NULL)
+      return false;
+   owl_fft_complex_workspace* workspace = inplace ?
+      owl_fft_complex_workspace_alloc_inplace(handle, wavetable->workspace_n) :
+      owl_fft_complex_workspace_alloc(handle, wavetable->workspace_n);
+   if (workspace == NULL)
+      return false;
+
+   double* result = (double*) malloc(count*sizeof(double));
+   double* expected = (double*) malloc(2*n*sizeof(double));
+   double* points = (double*) malloc(2*n*sizeof(double));
+   if (result == NULL || expected == NULL || points == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   for (int sign = -1; sign <= 1; sign += 2) {
+      double* x = random_values(count, state);
+      void* data = x != NULL ? device_values(handle, x, count) : NULL;
+      if (data == NULL)
+         return false;
+      // Rounded like the device sees them
+      host_values(handle, data, x, count);
+
+      int error = sign < 0 ? owl_fft_complex_forward(handle, data, stride, n, wavetable, workspace) :
+                             owl_fft_complex_inverse(handle, data, stride, n, wavetable, workspace);
+      if (error != 0) {
+         printf("Transform of %zu points failed!\n", n);
+         return false;
+      }
+      host_values(handle, data, result, count);
+
+      if (!host_dft(x, expected, n, stride, sign))
+         return false;
+      for (size_t k = 0; k < n; k++) {
+         REAL(points, k) = REAL(result, k*stride);
+         IMAG(points, k) = IMAG(result, k*stride);
+         if (sign > 0) {
+            REAL(expected, k) /= n;
+            IMAG(expected, k) /= n;
+         }
+      }
+      valid = within_tolerance(handle, sign < 0 ? "Forward transform" : "Inverse transform", n,
+                               relative_error(points, expected, 2*n)) && valid;
+
+      for (size_t i = 0; i < count/2; i++) {
+         if (i % stride != 0 && (REAL(result, i) != REAL(x, i) || IMAG(result, i) != IMAG(x, i))) {
+            printf("Transform of %zu points at stride %zu changed the values in between\n", n, stride);
+            valid = false;
+            break;
+         }
+      }
+      free(data);
+      free(x);
+   }
+
+   free(points);
+   free(expected);
+   free(result);
+   owl_fft_complex_workspace_free(workspace);
+   owl_fft_complex_wavetable_free(wavetable);
+   return valid;
+}
+
+
+static bool check_batch(owl_fft_handle* handle, size_t n, size_t howmany, size_t dist, cl_uint* state) {
+   size_t count = 2*howmany*dist;
+   bool valid = true;
+
+   owl_fft_complex_wavetable* wavetable = owl_fft_complex_wavetable_alloc(handle, n);
+   if (wavetable == NULL)
+      return false;
+   owl_fft_complex_workspace* workspace = owl_fft_complex_workspace_alloc(handle, howmany*wavetable->workspace_n);
+   if (workspace == NULL)
+      return false;
+
+   double* result = (double*) malloc(count*sizeof(double));
+   double* expected = (double*) malloc(count*sizeof(double));
+   if (result == NULL || expected == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   for (int sign = -1; sign <= 1; sign += 2) {
+      double* x = random_values(count, state);
+      void* data = x != NULL ? device_values(handle, x, count) : NULL;
+      if (data == NULL)
+         return false;
+      host_values(handle, data, x, count);
+
+      int error = sign < 0 ? owl_fft_complex_forward_batch(handle, data, n, howmany, dist, wavetable, workspace) :
+                             owl_fft_complex_inverse_batch(handle, data, n, howmany, dist, wavetable, workspace);
+      if (error != 0) {
+         printf("Batch of %zu transforms of %zu points failed!\n", howmany, n);
+         return false;
+      }
+      host_values(handle, data, result, count);
+
+      for (size_t b = 0; b < howmany; b++) {
+         if (!host_dft(&x[2*b*dist], &expected[2*b*n], n, 1, sign))
+            return false;
+         memmove(&result[2*b*n], &result[2*b*dist], 2*n*sizeof(double));
+      }
+      if (sign > 0) {
+         for (size_t i = 0; i < 2*howmany*n; i++)
+            expected[i] /= n;
+      }
+      valid = within_tolerance(handle, sign < 0 ? "Forward batch" : "Inverse batch", n,
+                               relative_error(result, expected, 2*howmany*n)) && valid;
+      free(data);
+      free(x);
+   }
+
+   free(expected);
+   free(result);
+   owl_fft_complex_workspace_free(workspace);
+   owl_fft_complex_wavetable_free(wavetable);
+   return valid;
+}
+
+
+// The forward transform of n random reals, and the inverse transform of the spectrum of
+// other random reals, which gives them back.
+static bool check_real(owl_fft_handle* handle, size_t n, cl_uint* state) {
+   size_t half_n = n/2;
+   bool valid;
+
+   owl_fft_real_wavetable* wavetable = owl_fft_real_wavetable_alloc(handle, n);
+   if (wavetable == NULL)
+      return false;
+   size_t workspace_n = half_n + 1 > wavetable->complex->workspace_n ? half_n + 1 : wavetable->complex->workspace_n;
+   owl_fft_complex_workspace* workspace = owl_fft_complex_workspace_alloc(handle, workspace_n);
+   if (workspace == NULL)
+      return false;
+
+   double* x = random_values(n, state);
+   double* complex = (double*) calloc(2*n, sizeof(double));
+   double* expected = (double*) malloc(2*n*sizeof(double));
+   double* result = (double*) malloc(2*(half_n + 1)*sizeof(double));
+   void* data = x != NULL ? device_values(handle, x, n) : NULL;
+   void* spectrum = malloc(2*(half_n + 1)*handle->real_size);
+   if (complex == NULL || expected == NULL || result == NULL || data == NULL || spectrum == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   host_values(handle, data, x, n);
+   for (size_t i = 0; i < n; i++)
+      REAL(complex, i) = x[i];
+   if (!host_dft(complex, expected, n, 1, -1))
+      return false;
+
+   if (owl_fft_real_forward(handle, data, spectrum, n, wavetable, workspace) != 0) {
+      printf("Real transform of %zu points failed!\n", n);
+      return false;
+   }
+   host_values(handle, spectrum, result, 2*(half_n + 1));
+   valid = within_tolerance(handle, "Real forward transform", n,
+                            relative_error(result, expected, 2*(half_n + 1)));
+
+   // Another signal, its spectrum from the host
+   free(x);
+   x = random_values(n, state);
+   if (x == NULL)
+      return false;
+   for (size_t i = 0; i < n; i++)
+      REAL(complex, i) = x[i];
+   if (!host_dft(complex, expected, n, 1, -1))
+      return false;
+   free(spectrum);
+   spectrum = device_values(handle, expected, 2*(half_n + 1));
+   if (spectrum == NULL)
+      return false;
+
+   if (owl_fft_real_inverse(handle, spectrum, data, n, wavetable, workspace) != 0) {
+      printf("Real transform of %zu points failed!\n", n);
+      return false;
+   }
+   host_values(handle, data, result, n);
+   valid = within_tolerance(handle, "Real inverse transform", n, relative_error(result, x, n)) && valid;
+
+   free(spectrum);
+   free(data);
+   free(result);
+   free(expected);
+   free(complex);
+   free(x);
+   owl_fft_complex_workspace_free(workspace);
+   owl_fft_real_wavetable_free(wavetable);
+   return valid;
+}
+
+
+static bool check_nd(owl_fft_handle* handle, cl_uint rank, const size_t* n, cl_uint* state) {
+   size_t size = 1;
+   bool valid = true;
+
+   owl_fft_complex_wavetable_nd* wavetable = owl_fft_complex_wavetable_nd_alloc(handle, rank, n);
+   if (wavetable == NULL)
+      return false;
+   // Each axis is transformed as a batch of all of its lines
+   size_t workspace_n = 0;
+   for (cl_uint a = 0; a < rank; a++) {
+      size_t axis_n = wavetable->size/n[a]*wavetable->axes[a]->workspace_n;
+      if (axis_n > workspace_n)
+         workspace_n = axis_n;
+      size *= n[a];
+   }
+   owl_fft_complex_workspace* workspace = owl_fft_complex_workspace_alloc(handle, workspace_n);
+   if (workspace == NULL)
+      return false;
+
+   double* result = (double*) malloc(2*size*sizeof(double));
+   if (result == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   for (int sign = -1; sign <= 1; sign += 2) {
+      double* x = random_values(2*size, state);
+      void* data = x != NULL ? device_values(handle, x, 2*size) : NULL;
+      if (data == NULL)
+         return false;
+      host_values(handle, data, x, 2*size);
+
+      int error = sign < 0 ? owl_fft_complex_forward_nd(handle, data, wavetable, workspace) :
+                             owl_fft_complex_inverse_nd(handle, data, wavetable, workspace);
+      if (error != 0) {
+         printf("Transform of rank %u failed!\n", rank);
+         return false;
+      }
+      host_values(handle, data, result, 2*size);
+
+      if (!host_dft_nd(x, rank, n, sign))
+         return false;
+      if (sign > 0) {
+         for (size_t i = 0; i < 2*size; i++)
+            x[i] /= size;
+      }
+      valid = within_tolerance(handle, rank == 2 ? "2D transform" : "3D transform", size,
+                               relative_error(result, x, 2*size)) && valid;
+      free(data);
+      free(x);
+   }
+
+   free(result);
+   owl_fft_complex_workspace_free(workspace);
+   owl_fft_complex_wavetable_nd_free(wavetable);
+   return valid;
+}
+
+
+// Convolution and correlation against the sums on the host
+static bool check_convolution(owl_fft_handle* handle, size_t signal_n, size_t filter_n, cl_uint* state) {
+   size_t output_n = signal_n + filter_n - 1;
+   bool valid;
+
+   owl_convolution* convolution = owl_convolution_alloc(handle, signal_n, filter_n);
+   if (convolution == NULL)
+      return false;
+
+   double* signal = random_values(2*signal_n, state);
+   double* filter = random_values(2*filter_n, state);
+   double* expected = (double*) calloc(2*output_n, sizeof(double));
+   double* result = (double*) malloc(2*output_n*sizeof(double));
+   void* signal_data = signal != NULL ? device_values(handle, signal, 2*signal_n) : NULL;
+   void* filter_data = filter != NULL ? device_values(handle, filter, 2*filter_n) : NULL;
+   void* output = malloc(2*output_n*handle->real_size);
+   if (expected == NULL || result == NULL || signal_data == NULL || filter_data == NULL || output == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   host_values(handle, signal_data, signal, 2*signal_n);
+   host_values(handle, filter_data, filter, 2*filter_n);
+
+   if (owl_convolution_set_filter(convolution, filter_data) != 0 ||
+       owl_convolve(convolution, signal_data, output) != 0) {
+      printf("Convolution of %zu points failed!\n", signal_n);
+      return false;
+   }
+   host_values(handle, output, result, 2*output_n);
+   for (size_t t = 0; t < signal_n; t++) {
+      for (size_t u = 0; u < filter_n; u++) {
+         REAL(expected, t + u) += REAL(signal, t)*REAL(filter, u) - IMAG(signal, t)*IMAG(filter, u);
+         IMAG(expected, t + u) += REAL(signal, t)*IMAG(filter, u) + IMAG(signal, t)*REAL(filter, u);
+      }
+   }
+   valid = within_tolerance(handle, "Convolution", signal_n, relative_error(result, expected, 2*output_n));
+
+   // output[j] = sum_u signal[u + j - filter_n + 1] conj(filter[u])
+   if (owl_correlate(convolution, signal_data, output) != 0) {
+      printf("Correlation of %zu points failed!\n", signal_n);
+      return false;
+   }
+   host_values(handle, output, result, 2*output_n);
+   memset(expected, 0, 2*output_n*sizeof(double));
+   for (size_t t = 0; t < signal_n; t++) {
+      for (size_t u = 0; u < filter_n; u++) {
+         size_t j = t + filter_n - 1 - u;
+         REAL(expected, j) += REAL(signal, t)*REAL(filter, u) + IMAG(signal, t)*IMAG(filter, u);
+         IMAG(expected, j) += IMAG(signal, t)*REAL(filter, u) - REAL(signal, t)*IMAG(filter, u);
+      }
+   }
+   valid = within_tolerance(handle, "Correlation", signal_n, relative_error(result, expected, 2*output_n)) && valid;
+
+   free(output);
+   free(filter_data);
+   free(signal_data);
+   free(result);
+   free(expected);
+   free(filter);
+   free(signal);
+   owl_convolution_free(convolution);
+   return valid;
 }
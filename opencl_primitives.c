@@ -0,0 +1,507 @@
+#include "opencl_primitives.h"
+
+#include <CL/cl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Kernel sources
+#include "opencl_primitives.cl.hex"
+
+// 32 banks of local memory, as on most GPUs. The padding costs little elsewhere.
+#define LOG_NUM_BANKS 5
+#define PADDED_SIZE(n) ((n) + ((n) >> LOG_NUM_BANKS))
+
+// Radix sort by 4 bits, in 8 passes. Each work-item counts and moves 4 keys.
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+#define RADIX_KEYS_PER_ITEM 4
+
+// At most this many work-groups for the segments, which loop over the rest
+#define MAX_SEGMENT_GROUPS 65536
+
+static const char* element_names[OPENCL_N_TYPES] = {"uint", "int", "float"};
+static const size_t element_sizes[OPENCL_N_TYPES] = {sizeof(cl_uint), sizeof(cl_int), sizeof(cl_float)};
+
+static bool build_primitives(opencl_primitives* primitives, opencl_element_type type);
+static bool build_program(opencl_primitives* primitives, opencl_element_type type, const char* prefix,
+                          cl_program* program);
+static bool compact(opencl_predicate* predicate, cl_mem input, cl_uint n, cl_mem output, cl_mem indices,
+                    cl_mem count, bool partition);
+static bool reserve_buffer(opencl_primitives* primitives, cl_mem* buffer, size_t* buffer_size, size_t size);
+static size_t fit_wg_size(size_t max_wg_size, cl_ulong local_mem_size, size_t element_size, size_t elements_per_item,
+                          bool padded);
+static bool scan_level(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type,
+                       bool inclusive, uint32_t level);
+static bool reduce_level(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type,
+                         cl_mem result, uint32_t level);
+
+
+bool opencl_primitives_init(opencl_primitives* primitives, opencl_handle* handle, uint32_t device) {
+   memset(primitives, 0, sizeof(opencl_primitives));
+   if (device >= handle->n_devices) {
+      printf("No device %u in the handle!\n", device);
+      return false;
+   }
+
+   primitives->context = handle->context;
+   primitives->device  = handle->devices[device];
+   primitives->queue   = handle->queues[device];
+
+   return true;
+}
+
+
+bool opencl_primitives_free(opencl_primitives* primitives) {
+   cl_int opencl_error;
+
+   for (int type = 0; type < OPENCL_N_TYPES; type++) {
+      if (primitives->programs[type] == NULL)
+         continue;
+      cl_kernel kernels[4] = {primitives->scan_kernels[type], primitives->add_kernels[type],
+                              primitives->reduce_kernels[type], primitives->segmented_kernels[type]};
+      for (int k = 0; k < 4; k++) {
+         opencl_error = clReleaseKernel(kernels[k]);
+         OPENCL_CHECK(opencl_error);
+      }
+      opencl_error = clReleaseProgram(primitives->programs[type]);
+      OPENCL_CHECK(opencl_error);
+   }
+   if (primitives->histogram_kernel != NULL) {
+      opencl_error = clReleaseKernel(primitives->histogram_kernel);
+      OPENCL_CHECK(opencl_error);
+      opencl_error = clReleaseKernel(primitives->scatter_kernel);
+      OPENCL_CHECK(opencl_error);
+   }
+
+   cl_mem buffers[3] = {primitives->counts_buffer, primitives->keys_buffer, primitives->values_buffer};
+   for (int b = 0; b < 3; b++) {
+      if (buffers[b] != NULL) {
+         opencl_error = clReleaseMemObject(buffers[b]);
+         OPENCL_CHECK(opencl_error);
+      }
+   }
+   for (uint32_t level = 0; level < OPENCL_SCAN_MAX_LEVELS; level++) {
+      if (primitives->sums_buffers[level] != NULL) {
+         opencl_error = clReleaseMemObject(primitives->sums_buffers[level]);
+         OPENCL_CHECK(opencl_error);
+      }
+   }
+
+   return true;
+}
+
+
+bool opencl_scan(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type, bool inclusive) {
+   if (n == 0)
+      return true;
+   if (primitives->programs[type] == NULL && !build_primitives(primitives, type))
+      return false;
+
+   return scan_level(primitives, buffer, n, type, inclusive, 0);
+}
+
+
+bool opencl_reduce(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type, cl_mem result) {
+   if (primitives->programs[type] == NULL && !build_primitives(primitives, type))
+      return false;
+
+   return reduce_level(primitives, buffer, n, type, result, 0);
+}
+
+
+bool opencl_segmented_reduce(opencl_primitives* primitives, cl_mem buffer, cl_mem offsets, cl_uint n_segments,
+                             opencl_element_type type, cl_mem results) {
+   cl_int opencl_error;
+
+   if (n_segments == 0)
+      return true;
+   if (primitives->programs[type] == NULL && !build_primitives(primitives, type))
+      return false;
+
+   cl_kernel kernel = primitives->segmented_kernels[type];
+   size_t wg_size = primitives->wg_sizes[type];
+   size_t global_size = (n_segments < MAX_SEGMENT_GROUPS ? n_segments : MAX_SEGMENT_GROUPS)*wg_size;
+
+   clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&buffer);
+   clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&offsets);
+   clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&results);
+   clSetKernelArg(kernel, 3, wg_size*element_sizes[type], NULL);
+   clSetKernelArg(kernel, 4, sizeof(cl_uint), (void *)&n_segments);
+
+   opencl_error = clEnqueueNDRangeKernel(primitives->queue, kernel, 1, NULL, &global_size, &wg_size, 0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   return true;
+}
+
+
+bool opencl_sort(opencl_primitives* primitives, cl_mem keys, cl_mem values, cl_uint n) {
+   cl_int opencl_error;
+
+   if (n <= 1)
+      return true;
+   if (primitives->programs[OPENCL_UINT] == NULL && !build_primitives(primitives, OPENCL_UINT))
+      return false;
+
+   size_t wg_size = primitives->radix_wg_size;
+   size_t block_size = RADIX_KEYS_PER_ITEM*wg_size;
+   cl_uint n_groups = (n + block_size - 1)/block_size;
+   size_t global_size = n_groups*wg_size;
+   size_t ranks_size = PADDED_SIZE(RADIX*wg_size)*sizeof(cl_uint);
+
+   if (!reserve_buffer(primitives, &primitives->counts_buffer, &primitives->counts_size,
+                       RADIX*n_groups*sizeof(cl_uint)))
+      return false;
+   if (!reserve_buffer(primitives, &primitives->keys_buffer, &primitives->keys_size, n*sizeof(cl_uint)))
+      return false;
+   if (values != NULL &&
+       !reserve_buffer(primitives, &primitives->values_buffer, &primitives->values_size, n*sizeof(cl_uint)))
+      return false;
+
+   // An even number of passes, so the keys end up where they started
+   cl_mem key_buffers[2]   = {keys, primitives->keys_buffer};
+   cl_mem value_buffers[2] = {values, values != NULL ? primitives->values_buffer : NULL};
+
+   for (cl_uint shift = 0; shift < 32; shift += RADIX_BITS) {
+      int from = (shift/RADIX_BITS) % 2;
+      int to   = 1 - from;
+
+      clSetKernelArg(primitives->histogram_kernel, 0, sizeof(cl_mem), (void *)&key_buffers[from]);
+      clSetKernelArg(primitives->histogram_kernel, 1, sizeof(cl_mem), (void *)&primitives->counts_buffer);
+      clSetKernelArg(primitives->histogram_kernel, 2, sizeof(cl_uint), (void *)&n);
+      clSetKernelArg(primitives->histogram_kernel, 3, sizeof(cl_uint), (void *)&shift);
+      opencl_error = clEnqueueNDRangeKernel(primitives->queue, primitives->histogram_kernel, 1, NULL, &global_size,
+                                            &wg_size, 0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+
+      if (!opencl_scan(primitives, primitives->counts_buffer, RADIX*n_groups, OPENCL_UINT, false))
+         return false;
+
+      clSetKernelArg(primitives->scatter_kernel, 0, sizeof(cl_mem), (void *)&key_buffers[from]);
+      clSetKernelArg(primitives->scatter_kernel, 1, sizeof(cl_mem), (void *)&value_buffers[from]);
+      clSetKernelArg(primitives->scatter_kernel, 2, sizeof(cl_mem), (void *)&key_buffers[to]);
+      clSetKernelArg(primitives->scatter_kernel, 3, sizeof(cl_mem), (void *)&value_buffers[to]);
+      clSetKernelArg(primitives->scatter_kernel, 4, sizeof(cl_mem), (void *)&primitives->counts_buffer);
+      clSetKernelArg(primitives->scatter_kernel, 5, ranks_size, NULL);
+      clSetKernelArg(primitives->scatter_kernel, 6, sizeof(cl_uint), (void *)&n);
+      clSetKernelArg(primitives->scatter_kernel, 7, sizeof(cl_uint), (void *)&shift);
+      opencl_error = clEnqueueNDRangeKernel(primitives->queue, primitives->scatter_kernel, 1, NULL, &global_size,
+                                            &wg_size, 0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+   }
+
+   return true;
+}
+
+
+bool opencl_predicate_init(opencl_predicate* predicate, opencl_primitives* primitives, opencl_element_type type,
+                           const char* condition) {
+   cl_int opencl_error;
+   size_t count_wg_size, scatter_wg_size;
+   cl_ulong local_mem_size;
+
+   memset(predicate, 0, sizeof(opencl_predicate));
+   predicate->primitives = primitives;
+   predicate->type = type;
+
+   // The parentheses keep the condition together inside the kernels
+   char* prefix = (char*) malloc(strlen(condition) + 64);
+   if (prefix == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   sprintf(prefix, "#define PREDICATE(x, i) (%s)\n", condition);
+   bool built = build_program(primitives, type, prefix, &predicate->program);
+   free(prefix);
+   if (!built)
+      return false;
+
+   predicate->count_kernel = clCreateKernel(predicate->program, "compact_count", &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   predicate->scatter_kernel = clCreateKernel(predicate->program, "compact_scatter", &opencl_error);
+   OPENCL_CHECK(opencl_error);
+
+   opencl_error = clGetKernelWorkGroupInfo(predicate->count_kernel, primitives->device, CL_KERNEL_WORK_GROUP_SIZE,
+                                           sizeof(size_t), &count_wg_size, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clGetKernelWorkGroupInfo(predicate->scatter_kernel, primitives->device, CL_KERNEL_WORK_GROUP_SIZE,
+                                           sizeof(size_t), &scatter_wg_size, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clGetDeviceInfo(primitives->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &local_mem_size,
+                                  NULL);
+   OPENCL_CHECK(opencl_error);
+   predicate->wg_size = fit_wg_size(count_wg_size < scatter_wg_size ? count_wg_size : scatter_wg_size,
+                                    local_mem_size, sizeof(cl_uint), 2, true);
+
+   return true;
+}
+
+
+bool opencl_predicate_free(opencl_predicate* predicate) {
+   cl_int opencl_error;
+
+   opencl_error = clReleaseKernel(predicate->count_kernel);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clReleaseKernel(predicate->scatter_kernel);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clReleaseProgram(predicate->program);
+   OPENCL_CHECK(opencl_error);
+
+   return true;
+}
+
+
+bool opencl_compact(opencl_predicate* predicate, cl_mem input, cl_uint n, cl_mem output, cl_mem indices,
+                    cl_mem count) {
+   return compact(predicate, input, n, output, indices, count, false);
+}
+
+
+bool opencl_partition(opencl_predicate* predicate, cl_mem input, cl_uint n, cl_mem output, cl_mem indices,
+                      cl_mem count) {
+   return compact(predicate, input, n, output, indices, count, true);
+}
+
+
+// Scan the blocks, then recurse on their totals and add those back to the blocks. The
+// totals are scanned exclusively, so that block g gets the sum of the blocks before it.
+static bool scan_level(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type,
+                       bool inclusive, uint32_t level) {
+   cl_int opencl_error;
+   cl_kernel scan_kernel = primitives->scan_kernels[type];
+   size_t wg_size = primitives->wg_sizes[type];
+   size_t block_size = 2*wg_size;
+   cl_uint inclusive_arg = inclusive;
+   cl_uint nblocks = (n + block_size - 1)/block_size;
+   size_t global_size = nblocks*wg_size;
+   cl_mem sums_buffer = NULL;
+
+   if (nblocks > 1) {
+      if (level >= OPENCL_SCAN_MAX_LEVELS) {
+         printf("Too many scan levels!\n");
+         return false;
+      }
+      if (!reserve_buffer(primitives, &primitives->sums_buffers[level], &primitives->sums_sizes[level],
+                          nblocks*element_sizes[type]))
+         return false;
+      sums_buffer = primitives->sums_buffers[level];
+   }
+
+   clSetKernelArg(scan_kernel, 0, sizeof(cl_mem), (void *)&buffer);
+   clSetKernelArg(scan_kernel, 1, sizeof(cl_mem), (void *)&sums_buffer);
+   clSetKernelArg(scan_kernel, 2, PADDED_SIZE(block_size)*element_sizes[type], NULL);
+   clSetKernelArg(scan_kernel, 3, sizeof(cl_uint), (void *)&n);
+   clSetKernelArg(scan_kernel, 4, sizeof(cl_uint), (void *)&inclusive_arg);
+
+   opencl_error = clEnqueueNDRangeKernel(primitives->queue, scan_kernel, 1, NULL, &global_size, &wg_size,
+                                         0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   if (nblocks > 1) {
+      if (!scan_level(primitives, sums_buffer, nblocks, type, false, level + 1))
+         return false;
+
+      cl_kernel add_kernel = primitives->add_kernels[type];
+      clSetKernelArg(add_kernel, 0, sizeof(cl_mem), (void *)&buffer);
+      clSetKernelArg(add_kernel, 1, sizeof(cl_mem), (void *)&sums_buffer);
+      clSetKernelArg(add_kernel, 2, sizeof(cl_uint), (void *)&n);
+      opencl_error = clEnqueueNDRangeKernel(primitives->queue, add_kernel, 1, NULL, &global_size, &wg_size,
+                                            0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+   }
+
+   return true;
+}
+
+
+// Sum the blocks into the totals of this level, and those again until a single block
+// sums into the result. An empty buffer is a single block of zeros.
+static bool reduce_level(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type,
+                         cl_mem result, uint32_t level) {
+   cl_int opencl_error;
+   cl_kernel kernel = primitives->reduce_kernels[type];
+   size_t wg_size = primitives->wg_sizes[type];
+   size_t block_size = 2*wg_size;
+   cl_uint nblocks = n > 0 ? (n + block_size - 1)/block_size : 1;
+   size_t global_size = nblocks*wg_size;
+   cl_mem sums_buffer = result;
+
+   if (nblocks > 1) {
+      if (level >= OPENCL_SCAN_MAX_LEVELS) {
+         printf("Too many reduction levels!\n");
+         return false;
+      }
+      if (!reserve_buffer(primitives, &primitives->sums_buffers[level], &primitives->sums_sizes[level],
+                          nblocks*element_sizes[type]))
+         return false;
+      sums_buffer = primitives->sums_buffers[level];
+   }
+
+   clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&buffer);
+   clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&sums_buffer);
+   clSetKernelArg(kernel, 2, wg_size*element_sizes[type], NULL);
+   clSetKernelArg(kernel, 3, sizeof(cl_uint), (void *)&n);
+
+   opencl_error = clEnqueueNDRangeKernel(primitives->queue, kernel, 1, NULL, &global_size, &wg_size, 0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   if (nblocks > 1)
+      return reduce_level(primitives, sums_buffer, nblocks, type, result, level + 1);
+
+   return true;
+}
+
+
+// Count the kept elements of each block, scan the counts, and scatter. The counts share
+// the buffer of the radix sort, with one more at the end for the total.
+static bool compact(opencl_predicate* predicate, cl_mem input, cl_uint n, cl_mem output, cl_mem indices,
+                    cl_mem count, bool partition) {
+   static const cl_uint zero = 0;
+   cl_int opencl_error;
+   opencl_primitives* primitives = predicate->primitives;
+
+   if (n == 0) {
+      opencl_error = clEnqueueWriteBuffer(primitives->queue, count, CL_FALSE, 0, sizeof(cl_uint), &zero,
+                                          0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+      return true;
+   }
+
+   size_t wg_size = predicate->wg_size;
+   size_t block_size = 2*wg_size;
+   cl_uint n_groups = (n + block_size - 1)/block_size;
+   size_t global_size = n_groups*wg_size;
+   cl_uint partition_arg = partition;
+
+   if (!reserve_buffer(primitives, &primitives->counts_buffer, &primitives->counts_size,
+                       (n_groups + 1)*sizeof(cl_uint)))
+      return false;
+
+   clSetKernelArg(predicate->count_kernel, 0, sizeof(cl_mem), (void *)&input);
+   clSetKernelArg(predicate->count_kernel, 1, sizeof(cl_mem), (void *)&primitives->counts_buffer);
+   clSetKernelArg(predicate->count_kernel, 2, sizeof(cl_uint), (void *)&n);
+   opencl_error = clEnqueueNDRangeKernel(primitives->queue, predicate->count_kernel, 1, NULL, &global_size,
+                                         &wg_size, 0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   if (!opencl_scan(primitives, primitives->counts_buffer, n_groups + 1, OPENCL_UINT, false))
+      return false;
+
+   clSetKernelArg(predicate->scatter_kernel, 0, sizeof(cl_mem), (void *)&input);
+   clSetKernelArg(predicate->scatter_kernel, 1, sizeof(cl_mem), (void *)&output);
+   clSetKernelArg(predicate->scatter_kernel, 2, sizeof(cl_mem), (void *)&indices);
+   clSetKernelArg(predicate->scatter_kernel, 3, sizeof(cl_mem), (void *)&primitives->counts_buffer);
+   clSetKernelArg(predicate->scatter_kernel, 4, sizeof(cl_mem), (void *)&count);
+   clSetKernelArg(predicate->scatter_kernel, 5, PADDED_SIZE(block_size)*sizeof(cl_uint), NULL);
+   clSetKernelArg(predicate->scatter_kernel, 6, sizeof(cl_uint), (void *)&n);
+   clSetKernelArg(predicate->scatter_kernel, 7, sizeof(cl_uint), (void *)&partition_arg);
+   opencl_error = clEnqueueNDRangeKernel(primitives->queue, predicate->scatter_kernel, 1, NULL, &global_size,
+                                         &wg_size, 0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   return true;
+}
+
+
+// Grow a cached buffer to at least size bytes. The old contents are not kept.
+static bool reserve_buffer(opencl_primitives* primitives, cl_mem* buffer, size_t* buffer_size, size_t size) {
+   cl_int opencl_error;
+
+   if (*buffer_size >= size)
+      return true;
+
+   if (*buffer != NULL) {
+      opencl_error = clReleaseMemObject(*buffer);
+      OPENCL_CHECK(opencl_error);
+   }
+   *buffer = clCreateBuffer(primitives->context, CL_MEM_READ_WRITE, size, NULL, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   *buffer_size = size;
+
+   return true;
+}
+
+
+// The largest power of two work-group size up to max_wg_size for which elements_per_item
+// elements of local memory for each work-item, padded or not, fit on the device
+static size_t fit_wg_size(size_t max_wg_size, cl_ulong local_mem_size, size_t element_size, size_t elements_per_item,
+                          bool padded) {
+   size_t wg_size = 1;
+   while (2*wg_size <= max_wg_size) {
+      size_t elements = 2*wg_size*elements_per_item;
+      if ((padded ? PADDED_SIZE(elements) : elements)*element_size > local_mem_size)
+         break;
+      wg_size *= 2;
+   }
+   return wg_size;
+}
+
+
+// Build the kernels for one element type, and pick the largest power of two work-group
+// size that the kernels and the local memory allow. The uint program has the radix sort.
+static bool build_primitives(opencl_primitives* primitives, opencl_element_type type) {
+   cl_int opencl_error;
+   cl_program program;
+   size_t max_wg_size = SIZE_MAX;
+   cl_ulong local_mem_size;
+
+   if (!build_program(primitives, type, "", &program))
+      return false;
+   primitives->programs[type] = program;
+
+   const char* names[4] = {"scan", "add_totals", "reduce", "segmented_reduce"};
+   cl_kernel* kernels[4] = {&primitives->scan_kernels[type], &primitives->add_kernels[type],
+                            &primitives->reduce_kernels[type], &primitives->segmented_kernels[type]};
+   for (int k = 0; k < 4; k++) {
+      size_t kernel_wg_size;
+      *kernels[k] = clCreateKernel(program, names[k], &opencl_error);
+      OPENCL_CHECK(opencl_error);
+      opencl_error = clGetKernelWorkGroupInfo(*kernels[k], primitives->device, CL_KERNEL_WORK_GROUP_SIZE,
+                                              sizeof(size_t), &kernel_wg_size, NULL);
+      OPENCL_CHECK(opencl_error);
+      if (kernel_wg_size < max_wg_size)
+         max_wg_size = kernel_wg_size;
+   }
+
+   opencl_error = clGetDeviceInfo(primitives->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &local_mem_size,
+                                  NULL);
+   OPENCL_CHECK(opencl_error);
+   primitives->wg_sizes[type] = fit_wg_size(max_wg_size, local_mem_size, element_sizes[type], 2, true);
+
+   if (type == OPENCL_UINT) {
+      size_t histogram_wg_size, scatter_wg_size;
+      primitives->histogram_kernel = clCreateKernel(program, "radix_histogram", &opencl_error);
+      OPENCL_CHECK(opencl_error);
+      primitives->scatter_kernel = clCreateKernel(program, "radix_scatter", &opencl_error);
+      OPENCL_CHECK(opencl_error);
+      opencl_error = clGetKernelWorkGroupInfo(primitives->histogram_kernel, primitives->device,
+                                              CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &histogram_wg_size, NULL);
+      OPENCL_CHECK(opencl_error);
+      opencl_error = clGetKernelWorkGroupInfo(primitives->scatter_kernel, primitives->device,
+                                              CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &scatter_wg_size, NULL);
+      OPENCL_CHECK(opencl_error);
+      // The scatter ranks need RADIX counters for each work-item
+      primitives->radix_wg_size = fit_wg_size(histogram_wg_size < scatter_wg_size ? histogram_wg_size :
+                                              scatter_wg_size, local_mem_size, sizeof(cl_uint), RADIX, true);
+   }
+
+   return true;
+}
+
+
+// Create and build the program of the primitives for one element type, with the prefix
+// before the source. The binaries are cached for each type and predicate.
+static bool build_program(opencl_primitives* primitives, opencl_element_type type, const char* prefix,
+                          cl_program* program) {
+   char options[128];
+
+   const char* sources[2] = {prefix, opencl_primitives_cl};
+   const size_t lengths[2] = {strlen(prefix), opencl_primitives_cl_len};
+   snprintf(options, sizeof(options), "-DELEMENT=%s -DLOG_NUM_BANKS=%d -DRADIX_BITS=%d -DRADIX_KEYS_PER_ITEM=%d",
+            element_names[type], LOG_NUM_BANKS, RADIX_BITS, RADIX_KEYS_PER_ITEM);
+
+   return opencl_build_program(primitives->context, 1, &primitives->device, 2, sources, lengths, options, program);
+}
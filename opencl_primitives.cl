@@ -0,0 +1,330 @@
+// Parallel primitives of openclutils, built once for each element type with
+//   ELEMENT        uint, int or float
+//   LOG_NUM_BANKS  log2 of the number of local memory banks
+//   RADIX_BITS, RADIX_KEYS_PER_ITEM  see the radix sort
+// The work-group size is a power of two.
+
+// The scan tree reads local memory with power-of-two strides, which would hit the same
+// bank over and over. One element of padding after every bank row spreads them out.
+#define PADDED(i) ((i) + ((i) >> LOG_NUM_BANKS))
+
+
+// Work-efficient scan of blocks of 2*local size elements in place, following GPU gems 3,
+// chapter 39. The total of each block goes to sums, if given, for the next level.
+__kernel void scan(__global ELEMENT* data, __global ELEMENT* sums, __local ELEMENT* workspace, uint data_size,
+                   uint inclusive) {
+   uint thread_id = get_local_id(0);
+   uint scan_size = get_local_size(0);
+   uint offset = 2*scan_size*get_group_id(0);
+   uint ai = thread_id;
+   uint bi = thread_id + scan_size;
+
+   data = data + offset;
+   data_size = min(data_size - offset, 2*scan_size);
+
+   // The last work-group may be short, pad it with zeros
+   ELEMENT a = ai < data_size ? data[ai] : 0;
+   ELEMENT b = bi < data_size ? data[bi] : 0;
+   workspace[PADDED(ai)] = a;
+   workspace[PADDED(bi)] = b;
+
+   // Reduction
+   offset = 1;
+   for (uint d = scan_size; d > 0; d >>= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      if (thread_id < d) {
+         uint i = offset*(2*thread_id + 1) - 1;
+         uint j = i + offset;
+         workspace[PADDED(j)] += workspace[PADDED(i)];
+      }
+      offset <<= 1;
+   }
+
+   // The root holds the total. Clearing it and sweeping down gives the exclusive scan.
+   if (thread_id == 0) {
+      uint root = PADDED(2*scan_size - 1);
+      if (sums)
+         sums[get_group_id(0)] = workspace[root];
+      workspace[root] = 0;
+   }
+   for (uint d = 1; d <= scan_size; d <<= 1) {
+      offset >>= 1;
+      barrier(CLK_LOCAL_MEM_FENCE);
+      if (thread_id < d) {
+         uint i = offset*(2*thread_id + 1) - 1;
+         uint j = i + offset;
+         ELEMENT t = workspace[PADDED(i)];
+         workspace[PADDED(i)] = workspace[PADDED(j)];
+         workspace[PADDED(j)] += t;
+      }
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if (ai < data_size)
+      data[ai] = inclusive ? workspace[PADDED(ai)] + a : workspace[PADDED(ai)];
+   if (bi < data_size)
+      data[bi] = inclusive ? workspace[PADDED(bi)] + b : workspace[PADDED(bi)];
+}
+
+
+// Add the exclusive scan of the block totals to the blocks. The first block has nothing
+// to add.
+__kernel void add_totals(__global ELEMENT* data, __global const ELEMENT* sums, uint data_size) {
+   uint thread_id = get_local_id(0);
+   uint scan_size = get_local_size(0);
+   uint group     = get_group_id(0);
+
+   if (group > 0) {
+      ELEMENT to_add = sums[group];
+      uint offset = group*2*scan_size + thread_id;
+      if (offset < data_size)
+         data[offset] += to_add;
+      offset += scan_size;
+      if (offset < data_size)
+         data[offset] += to_add;
+   }
+}
+
+
+// Sum of the values of all work-items, with sequential addressing so that the work-items
+// of each step read consecutive banks. The workspace can be reused after this.
+ELEMENT local_sum(__local ELEMENT* workspace, ELEMENT value) {
+   uint thread_id = get_local_id(0);
+
+   workspace[thread_id] = value;
+   for (uint d = get_local_size(0) >> 1; d > 0; d >>= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      if (thread_id < d)
+         workspace[thread_id] += workspace[thread_id + d];
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+   value = workspace[0];
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   return value;
+}
+
+
+// Exclusive scan of size uints in local memory, with the padded indices and the sweeps of
+// scan. The size is a power of two, with any number of elements for each work-item.
+// Returns the total.
+uint local_scan(__local uint* data, uint size) {
+   uint thread_id  = get_local_id(0);
+   uint local_size = get_local_size(0);
+   uint offset = 1;
+
+   for (uint d = size >> 1; d > 0; d >>= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      for (uint k = thread_id; k < d; k += local_size) {
+         uint i = offset*(2*k + 1) - 1;
+         uint j = i + offset;
+         data[PADDED(j)] += data[PADDED(i)];
+      }
+      offset <<= 1;
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+   uint total = data[PADDED(size - 1)];
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if (thread_id == 0)
+      data[PADDED(size - 1)] = 0;
+   for (uint d = 1; d < size; d <<= 1) {
+      offset >>= 1;
+      barrier(CLK_LOCAL_MEM_FENCE);
+      for (uint k = thread_id; k < d; k += local_size) {
+         uint i = offset*(2*k + 1) - 1;
+         uint j = i + offset;
+         uint t = data[PADDED(i)];
+         data[PADDED(i)] = data[PADDED(j)];
+         data[PADDED(j)] += t;
+      }
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   return total;
+}
+
+
+// Sums of blocks of 2*local size elements, as in scan. The host reduces the sums again
+// until one is left.
+__kernel void reduce(__global const ELEMENT* data, __global ELEMENT* sums, __local ELEMENT* workspace,
+                     uint data_size) {
+   uint scan_size = get_local_size(0);
+   uint offset = 2*scan_size*get_group_id(0) + get_local_id(0);
+
+   ELEMENT sum = offset < data_size ? data[offset] : 0;
+   if (offset + scan_size < data_size)
+      sum += data[offset + scan_size];
+
+   sum = local_sum(workspace, sum);
+   if (get_local_id(0) == 0)
+      sums[get_group_id(0)] = sum;
+}
+
+
+// Sums of the segments data[offsets[s]] ... data[offsets[s + 1] - 1], a work-group for
+// each segment at a time.
+__kernel void segmented_reduce(__global const ELEMENT* data, __global const uint* offsets, __global ELEMENT* sums,
+                               __local ELEMENT* workspace, uint n_segments) {
+   for (uint segment = get_group_id(0); segment < n_segments; segment += get_num_groups(0)) {
+      uint end = offsets[segment + 1];
+      ELEMENT sum = 0;
+
+      for (uint i = offsets[segment] + get_local_id(0); i < end; i += get_local_size(0))
+         sum += data[i];
+
+      sum = local_sum(workspace, sum);
+      if (get_local_id(0) == 0)
+         sums[segment] = sum;
+   }
+}
+
+
+// Least significant digit radix sort of uint keys, RADIX_BITS at a time. Each work-item takes
+// RADIX_KEYS_PER_ITEM consecutive keys, so the keys of a work-group keep their order
+// when they are scattered, and each pass is stable.
+#define RADIX (1 << RADIX_BITS)
+#define DIGIT(key, shift) (((key) >> (shift)) & (RADIX - 1))
+
+// Count the digits of the keys of each work-group. The counts are stored digit by digit,
+// counts[digit*groups + group], so that their exclusive scan is where the keys of each
+// work-group go.
+__kernel void radix_histogram(__global const uint* keys, __global uint* counts, uint data_size, uint shift) {
+   __local uint histogram[RADIX];
+   uint thread_id = get_local_id(0);
+   uint first = get_global_id(0)*RADIX_KEYS_PER_ITEM;
+   uint last  = min(first + RADIX_KEYS_PER_ITEM, data_size);
+
+   for (uint digit = thread_id; digit < RADIX; digit += get_local_size(0))
+      histogram[digit] = 0;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for (uint i = first; i < last; i++)
+      atomic_inc(&histogram[DIGIT(keys[i], shift)]);
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for (uint digit = thread_id; digit < RADIX; digit += get_local_size(0))
+      counts[digit*get_num_groups(0) + get_group_id(0)] = histogram[digit];
+}
+
+
+// Move the keys, and the values if any, to their place for this digit. The offsets are
+// the scanned counts of radix_histogram.
+__kernel void radix_scatter(__global const uint* keys, __global const uint* values, __global uint* sorted_keys,
+                            __global uint* sorted_values, __global const uint* offsets, __local uint* ranks,
+                            uint data_size, uint shift) {
+   uint thread_id  = get_local_id(0);
+   uint local_size = get_local_size(0);
+   uint first = get_global_id(0)*RADIX_KEYS_PER_ITEM;
+   uint last  = min(first + RADIX_KEYS_PER_ITEM, data_size);
+   uint position[RADIX];
+
+   for (uint digit = 0; digit < RADIX; digit++)
+      position[digit] = 0;
+   for (uint i = first; i < last; i++)
+      position[DIGIT(keys[i], shift)]++;
+   for (uint digit = 0; digit < RADIX; digit++)
+      ranks[PADDED(digit*local_size + thread_id)] = position[digit];
+
+   // Exclusive scan of the counts, digit by digit over the work-items
+   local_scan(ranks, RADIX*local_size);
+
+   // The keys go after those of the previous work-groups, and of the previous work-items
+   // of this work-group with the same digit. The entry of the first work-item counts the
+   // smaller digits of the work-group, which the offsets already cover.
+   for (uint digit = 0; digit < RADIX; digit++)
+      position[digit] = offsets[digit*get_num_groups(0) + get_group_id(0)] +
+                        ranks[PADDED(digit*local_size + thread_id)] - ranks[PADDED(digit*local_size)];
+
+   for (uint i = first; i < last; i++) {
+      uint key = keys[i];
+      uint to = position[DIGIT(key, shift)]++;
+      sorted_keys[to] = key;
+      if (values)
+         sorted_values[to] = values[i];
+   }
+}
+
+
+// Stream compaction, built with the condition of the predicate as
+//   PREDICATE(x, i)  true to keep element x at index i
+// Blocks of 2*local size elements as in scan. The predicate is evaluated in both kernels,
+// so that the flags never go through global memory.
+#ifdef PREDICATE
+
+// Count the kept elements of each block. The extra count after the last block is zero,
+// so that the exclusive scan of the counts ends with the total.
+__kernel void compact_count(__global const ELEMENT* data, __global uint* counts, uint data_size) {
+   __local uint block_count;
+   uint thread_id = get_local_id(0);
+   uint scan_size = get_local_size(0);
+   uint ai = 2*scan_size*get_group_id(0) + thread_id;
+   uint bi = ai + scan_size;
+   uint kept = 0;
+
+   if (thread_id == 0)
+      block_count = 0;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if (ai < data_size && PREDICATE(data[ai], ai))
+      kept++;
+   if (bi < data_size && PREDICATE(data[bi], bi))
+      kept++;
+   if (kept > 0)
+      atomic_add(&block_count, kept);
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if (thread_id == 0) {
+      counts[get_group_id(0)] = block_count;
+      if (get_group_id(0) == 0)
+         counts[get_num_groups(0)] = 0;
+   }
+}
+
+
+// Write the kept elements, or their indices, after those of the previous blocks. For a
+// partition, the others follow all the kept ones in their order. The offsets are the
+// scanned counts of compact_count, and the total goes to count.
+__kernel void compact_scatter(__global const ELEMENT* data, __global ELEMENT* output, __global uint* indices,
+                              __global const uint* offsets, __global uint* count, __local uint* ranks,
+                              uint data_size, uint partition) {
+   uint thread_id = get_local_id(0);
+   uint scan_size = get_local_size(0);
+   uint ai = 2*scan_size*get_group_id(0) + thread_id;
+   uint bi = ai + scan_size;
+   uint total = offsets[get_num_groups(0)];
+   uint first = offsets[get_group_id(0)];
+
+   ELEMENT a = ai < data_size ? data[ai] : 0;
+   ELEMENT b = bi < data_size ? data[bi] : 0;
+   uint keep_a = ai < data_size && PREDICATE(a, ai);
+   uint keep_b = bi < data_size && PREDICATE(b, bi);
+   ranks[PADDED(thread_id)] = keep_a;
+   ranks[PADDED(thread_id + scan_size)] = keep_b;
+
+   local_scan(ranks, 2*scan_size);
+
+   // Kept elements before each of the two. All other elements before it are not kept.
+   uint rank_a = first + ranks[PADDED(thread_id)];
+   uint rank_b = first + ranks[PADDED(thread_id + scan_size)];
+
+   if (ai < data_size && (keep_a || partition)) {
+      uint to = keep_a ? rank_a : total + ai - rank_a;
+      if (output)
+         output[to] = a;
+      if (indices)
+         indices[to] = ai;
+   }
+   if (bi < data_size && (keep_b || partition)) {
+      uint to = keep_b ? rank_b : total + bi - rank_b;
+      if (output)
+         output[to] = b;
+      if (indices)
+         indices[to] = bi;
+   }
+
+   if (get_global_id(0) == 0)
+      count[0] = total;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef OPENCL_PRIMITIVES_H
+#define OPENCL_PRIMITIVES_H
+
+#include <stdbool.h>
+#include <CL/cl.h>
+
+#include "opencl_utils.h"
+
+// Each level of a scan divides the size by at least two, so this covers any cl_uint size.
+#define OPENCL_SCAN_MAX_LEVELS 32
+
+typedef enum {
+  OPENCL_UINT,
+  OPENCL_INT,
+  OPENCL_FLOAT,
+  OPENCL_N_TYPES
+} opencl_element_type;
+
+typedef struct {
+  cl_context       context;
+  cl_device_id     device;
+  cl_command_queue queue;
+  // Built for each element type on first use
+  cl_program       programs[OPENCL_N_TYPES];
+  cl_kernel        scan_kernels[OPENCL_N_TYPES];
+  cl_kernel        add_kernels[OPENCL_N_TYPES];
+  cl_kernel        reduce_kernels[OPENCL_N_TYPES];
+  cl_kernel        segmented_kernels[OPENCL_N_TYPES];
+  size_t           wg_sizes[OPENCL_N_TYPES];
+  // Block totals of each level of scans and reductions, kept for the next call
+  cl_mem           sums_buffers[OPENCL_SCAN_MAX_LEVELS];
+  size_t           sums_sizes[OPENCL_SCAN_MAX_LEVELS];
+  // Radix sort, from the uint program, with its digit counts and the other half of the
+  // ping-pong buffers
+  cl_kernel        histogram_kernel, scatter_kernel;
+  size_t           radix_wg_size;
+  cl_mem           counts_buffer, keys_buffer, values_buffer;
+  size_t           counts_size, keys_size, values_size;
+} opencl_primitives;
+
+// Stream compaction with a predicate, see opencl_predicate_init
+typedef struct {
+  opencl_primitives* primitives;
+  opencl_element_type type;
+  cl_program       program;
+  cl_kernel        count_kernel, scatter_kernel;
+  size_t           wg_size;
+} opencl_predicate;
+
+
+/**
+ * Prepare the parallel primitives for one device of the handle, set up by opencl_setup.
+ * The kernels are built when an element type is first used.
+ * @param primitives Structure to fill.
+ * @param handle OpenCL handle with the context and the command queues.
+ * @param device Index of the device in the handle, the primitives use its queue.
+ * @return True on success, false on failure.
+ */
+bool opencl_primitives_init(opencl_primitives* primitives, opencl_handle* handle, uint32_t device);
+
+/**
+ * Release the programs, kernels and buffers of the primitives, but not the structure itself.
+ * @param primitives Primitives to be freed.
+ * @return True on success, false on failure.
+ */
+bool opencl_primitives_free(opencl_primitives* primitives);
+
+/**
+ * Prefix sum of the buffer in place. The blocks are scanned in work-groups, and their
+ * totals are scanned the same way, as many levels as needed. The kernels are enqueued
+ * in order on the queue of the device, and the call returns without waiting for them.
+ * This is not thread-safe, the kernels and buffers are shared by all calls.
+ * @param primitives Primitives of the device.
+ * @param buffer Buffer of n elements.
+ * @param n Number of elements.
+ * @param type Element type, cl_uint, cl_int or cl_float.
+ * @param inclusive Element i is the sum up to and including i, otherwise the sum before i.
+ * @return True on success, false on failure.
+ */
+bool opencl_scan(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type, bool inclusive);
+
+/**
+ * Sum of the elements of the buffer, reduced by work-groups level by level as in opencl_scan.
+ * The sum is left on the device, to be read or used by later kernels.
+ * @param primitives Primitives of the device.
+ * @param buffer Buffer of n elements, not modified.
+ * @param n Number of elements.
+ * @param type Element type, cl_uint, cl_int or cl_float.
+ * @param result Buffer for the sum, which goes to its first element.
+ * @return True on success, false on failure.
+ */
+bool opencl_reduce(opencl_primitives* primitives, cl_mem buffer, cl_uint n, opencl_element_type type, cl_mem result);
+
+/**
+ * Sums of consecutive segments of the buffer, one work-group for each segment at a time.
+ * Segment s covers the elements offsets[s] ... offsets[s + 1] - 1, and may be empty.
+ * @param primitives Primitives of the device.
+ * @param buffer Buffer of the elements, not modified.
+ * @param offsets Buffer of n_segments + 1 cl_uint offsets, in increasing order.
+ * @param n_segments Number of segments.
+ * @param type Element type, cl_uint, cl_int or cl_float.
+ * @param results Buffer for the n_segments sums.
+ * @return True on success, false on failure.
+ */
+bool opencl_segmented_reduce(opencl_primitives* primitives, cl_mem buffer, cl_mem offsets, cl_uint n_segments,
+                             opencl_element_type type, cl_mem results);
+
+/**
+ * Stable sort of 32-bit unsigned keys in place, least significant digit first. Each pass
+ * counts the digits in work-groups, scans the counts with opencl_scan, and scatters the
+ * keys, with the other half of the ping-pong buffers kept in the primitives.
+ * @param primitives Primitives of the device.
+ * @param keys Buffer of n cl_uint keys.
+ * @param values Buffer of n 32-bit values that move with the keys, or NULL.
+ * @param n Number of keys.
+ * @return True on success, false on failure.
+ */
+bool opencl_sort(opencl_primitives* primitives, cl_mem keys, cl_mem values, cl_uint n);
+
+/**
+ * Build the compaction kernels for a predicate, an OpenCL C expression of the element x
+ * and its index i, for example "x >= 100 && i % 2 == 0". It is evaluated as the elements
+ * are read, and again as they are written, with no flags in between.
+ * @param predicate Structure to fill.
+ * @param primitives Primitives of the device, used for the scans.
+ * @param type Element type, cl_uint, cl_int or cl_float.
+ * @param condition The expression.
+ * @return True on success, false on failure.
+ */
+bool opencl_predicate_init(opencl_predicate* predicate, opencl_primitives* primitives, opencl_element_type type,
+                           const char* condition);
+
+/**
+ * Release the program and kernels of the predicate, but not the structure itself.
+ * @param predicate Predicate to be freed.
+ * @return True on success, false on failure.
+ */
+bool opencl_predicate_free(opencl_predicate* predicate);
+
+/**
+ * Keep the elements for which the predicate holds, in order. The kept elements, their
+ * indices or both are written densely, and their number is written to the count buffer,
+ * so that later kernels can read it without a round trip to the host.
+ * @param predicate Predicate, built for the element type of the input.
+ * @param input Buffer of n elements, not modified.
+ * @param n Number of elements.
+ * @param output Buffer of up to n elements for the kept ones, or NULL.
+ * @param indices Buffer of up to n cl_uint for the indices of the kept ones, or NULL.
+ * @param count Buffer for the number of kept elements, a cl_uint.
+ * @return True on success, false on failure.
+ */
+bool opencl_compact(opencl_predicate* predicate, cl_mem input, cl_uint n, cl_mem output, cl_mem indices,
+                    cl_mem count);
+
+/**
+ * As opencl_compact, but the elements that are not kept follow the kept ones, also in
+ * order, so that output and indices have all n elements.
+ */
+bool opencl_partition(opencl_predicate* predicate, cl_mem input, cl_uint n, cl_mem output, cl_mem indices,
+                      cl_mem count);
+
+#endif
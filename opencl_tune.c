@@ -0,0 +1,307 @@
+#include "opencl_tune.h"
+#include "opencl_utils.h"
+#include "opencl_cache.h"
+
+#include <CL/cl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Timed launches of each candidate, after one to warm up
+#define TUNE_RUNS 3
+
+#define CACHE_FILE "launch_configs"
+
+typedef struct {
+   cl_command_queue queue;
+   cl_kernel kernel;
+   cl_uint dims;
+   const size_t* global_size;
+} fixed_launch;
+
+static bool kernel_hash(cl_kernel kernel, cl_device_id device, cl_uint dims, const char* problem,
+                        uint64_t* hash);
+static bool device_string(cl_device_id device, cl_device_info param, char** value);
+static bool program_hash(cl_program program, cl_device_id device, uint64_t* hash);
+static bool search_config(cl_command_queue queue, cl_kernel kernel, cl_device_id device, cl_uint dims,
+                          opencl_tune_launch launch, void* data, opencl_launch_config* config);
+static bool lookup_config(const char* key, opencl_launch_config* config);
+static void store_config(const char* key, const opencl_launch_config* config);
+static bool time_config(cl_command_queue queue, const opencl_launch_config* config, opencl_tune_launch launch,
+                        void* data, double* seconds, bool* fits);
+static cl_int launch_fixed(const opencl_launch_config* config, void* data);
+
+
+bool opencl_tune(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const char* problem,
+                 opencl_tune_launch launch, void* data, opencl_launch_config* config) {
+   cl_int opencl_error;
+   cl_device_id device;
+   char* device_name;
+   char* driver_version;
+
+   if (dims < 1 || dims > 3) {
+      printf("Cannot tune a launch of %u dimensions!\n", dims);
+      return false;
+   }
+
+   opencl_error = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   uint64_t hash;
+   if (!kernel_hash(kernel, device, dims, problem, &hash))
+      return false;
+   if (!device_string(device, CL_DEVICE_NAME, &device_name))
+      return false;
+   if (!device_string(device, CL_DRIVER_VERSION, &driver_version)) {
+      free(device_name);
+      return false;
+   }
+   size_t key_size = strlen(device_name) + strlen(driver_version) + 20;
+   char* key = (char*) malloc(key_size);
+   if (key != NULL)
+      snprintf(key, key_size, "%016" PRIx64 "\t%s\t%s\t", hash, device_name, driver_version);
+   free(device_name);
+   free(driver_version);
+   if (key == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   bool found = lookup_config(key, config);
+   if (!found && (found = search_config(queue, kernel, device, dims, launch, data, config)))
+      store_config(key, config);
+   free(key);
+   return found;
+}
+
+
+bool opencl_tune_kernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t* global_size,
+                        opencl_launch_config* config) {
+   fixed_launch fixed = {queue, kernel, dims, global_size};
+   char problem[64];
+   snprintf(problem, sizeof(problem), "%zu %zu %zu", global_size[0], dims > 1 ? global_size[1] : 1,
+            dims > 2 ? global_size[2] : 1);
+
+   return opencl_tune(queue, kernel, dims, problem, launch_fixed, &fixed, config);
+}
+
+
+// Time the choice of the implementation first, then every power of two that fits.
+static bool search_config(cl_command_queue queue, cl_kernel kernel, cl_device_id device, cl_uint dims,
+                          opencl_tune_launch launch, void* data, opencl_launch_config* config) {
+   cl_int opencl_error;
+   size_t max_wg_size, max_item_sizes[3];
+   opencl_error = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
+                                           &max_wg_size, NULL);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_item_sizes),
+                                  max_item_sizes, NULL);
+   OPENCL_CHECK(opencl_error);
+   for (cl_uint d = dims; d < 3; d++)
+      max_item_sizes[d] = 1;
+
+   opencl_launch_config candidate = {{0, 0, 0}};
+   double best_time = 0, seconds;
+   bool found = false, fits;
+   if (!time_config(queue, &candidate, launch, data, &seconds, &fits))
+      return false;
+   if (fits) {
+      *config = candidate;
+      best_time = seconds;
+      found = true;
+   }
+
+   for (size_t z = 1; z <= max_item_sizes[2]; z *= 2) {
+      for (size_t y = 1; y <= max_item_sizes[1] && y*z <= max_wg_size; y *= 2) {
+         for (size_t x = 1; x <= max_item_sizes[0] && x*y*z <= max_wg_size; x *= 2) {
+            candidate.local_size[0] = x;
+            candidate.local_size[1] = dims > 1 ? y : 0;
+            candidate.local_size[2] = dims > 2 ? z : 0;
+            if (!time_config(queue, &candidate, launch, data, &seconds, &fits))
+               return false;
+            if (fits && (!found || seconds < best_time)) {
+               *config = candidate;
+               best_time = seconds;
+               found = true;
+            }
+         }
+      }
+   }
+
+   if (!found)
+      printf("No launch configuration works for the kernel!\n");
+   return found;
+}
+
+
+static cl_int launch_fixed(const opencl_launch_config* config, void* data) {
+   fixed_launch* fixed = (fixed_launch*) data;
+
+   // Local sizes must divide the global size before OpenCL 2.0
+   if (config->local_size[0] != 0) {
+      for (cl_uint d = 0; d < fixed->dims; d++) {
+         if (fixed->global_size[d] % config->local_size[d] != 0)
+            return CL_INVALID_WORK_GROUP_SIZE;
+      }
+   }
+
+   return clEnqueueNDRangeKernel(fixed->queue, fixed->kernel, fixed->dims, NULL, fixed->global_size,
+                                 opencl_local_size(config), 0, NULL, NULL);
+}
+
+
+static bool time_config(cl_command_queue queue, const opencl_launch_config* config, opencl_tune_launch launch,
+                        void* data, double* seconds, bool* fits) {
+   cl_int opencl_error;
+   struct timespec start, end;
+
+   *fits = false;
+   opencl_error = launch(config, data);
+   if (opencl_error == CL_INVALID_WORK_GROUP_SIZE || opencl_error == CL_INVALID_WORK_ITEM_SIZE ||
+       opencl_error == CL_OUT_OF_RESOURCES)
+      return true;
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clFinish(queue);
+   OPENCL_CHECK(opencl_error);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for (int run = 0; run < TUNE_RUNS; run++) {
+      opencl_error = launch(config, data);
+      OPENCL_CHECK(opencl_error);
+   }
+   opencl_error = clFinish(queue);
+   OPENCL_CHECK(opencl_error);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   *seconds = (end.tv_sec - start.tv_sec) + 1e-9*(end.tv_nsec - start.tv_nsec);
+   *fits = true;
+   return true;
+}
+
+
+static bool kernel_hash(cl_kernel kernel, cl_device_id device, cl_uint dims, const char* problem,
+                        uint64_t* hash) {
+   cl_int opencl_error;
+   cl_program program;
+   size_t size;
+
+   opencl_error = clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(cl_program), &program, NULL);
+   OPENCL_CHECK(opencl_error);
+   if (!program_hash(program, device, hash))
+      return false;
+
+   opencl_error = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
+   OPENCL_CHECK(opencl_error);
+   char* name = (char*) malloc(size);
+   if (name == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   opencl_error = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size, name, NULL);
+   OPENCL_CHECK(opencl_error);
+   *hash = opencl_hash(*hash, name, size);
+   free(name);
+
+   *hash = opencl_hash(*hash, &dims, sizeof(dims));
+   *hash = opencl_hash(*hash, problem, strlen(problem) + 1);
+   return true;
+}
+
+
+// Hash of the binary and build options of the program for the device. The binary is the
+// same whether the program was built from source or loaded from the cache.
+static bool program_hash(cl_program program, cl_device_id device, uint64_t* hash) {
+   cl_int opencl_error;
+   size_t size;
+
+   *hash = OPENCL_HASH_INIT;
+   unsigned char* binary = opencl_program_binary(program, device, &size);
+   if (binary != NULL) {
+      *hash = opencl_hash(*hash, binary, size);
+      free(binary);
+   }
+
+   opencl_error = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_OPTIONS, 0, NULL, &size);
+   OPENCL_CHECK(opencl_error);
+   char* options = (char*) malloc(size);
+   if (options == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   opencl_error = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_OPTIONS, size, options, NULL);
+   OPENCL_CHECK(opencl_error);
+   *hash = opencl_hash(*hash, options, size);
+   free(options);
+
+   return true;
+}
+
+
+// Value of a string query of the device, sized by querying it first.
+static bool device_string(cl_device_id device, cl_device_info param, char** value) {
+   cl_int opencl_error;
+   size_t size;
+
+   opencl_error = clGetDeviceInfo(device, param, 0, NULL, &size);
+   OPENCL_CHECK(opencl_error);
+   *value = (char*) malloc(size);
+   if (*value == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   opencl_error = clGetDeviceInfo(device, param, size, *value, NULL);
+   if (opencl_error != CL_SUCCESS)
+      free(*value);
+   OPENCL_CHECK(opencl_error);
+   return true;
+}
+
+
+// One line for each tuned kernel: the key, then the local size. Lines are only appended,
+// so the last one for a key is the latest. They are read whole, however long the device
+// name and driver version in the key are.
+static bool lookup_config(const char* key, opencl_launch_config* config) {
+   char* line = NULL;
+   size_t line_size = 0;
+   size_t key_length = strlen(key);
+   bool found = false;
+
+   char* path = opencl_cache_path("openclutils", CACHE_FILE);
+   if (path == NULL)
+      return false;
+   FILE* file = fopen(path, "r");
+   free(path);
+   if (file == NULL)
+      return false;
+
+   while (getline(&line, &line_size, file) != -1) {
+      opencl_launch_config cached;
+      if (strncmp(line, key, key_length) == 0 &&
+          sscanf(line + key_length, "%zu %zu %zu", &cached.local_size[0], &cached.local_size[1],
+                 &cached.local_size[2]) == 3) {
+         *config = cached;
+         found = true;
+      }
+   }
+   free(line);
+   fclose(file);
+   return found;
+}
+
+
+static void store_config(const char* key, const opencl_launch_config* config) {
+   char* path = opencl_cache_path("openclutils", CACHE_FILE);
+   if (path == NULL)
+      return;
+   FILE* file = fopen(path, "a");
+   free(path);
+   if (file == NULL)
+      return;
+
+   fprintf(file, "%s%zu %zu %zu\n", key, config->local_size[0], config->local_size[1], config->local_size[2]);
+   fclose(file);
+}
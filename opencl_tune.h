@@ -0,0 +1,64 @@
+#ifndef OPENCL_TUNE_H
+#define OPENCL_TUNE_H
+
+#include <stdbool.h>
+#include <CL/cl.h>
+
+// Local size of a kernel launch. A zero local size leaves it to the implementation,
+// to be passed as NULL to clEnqueueNDRangeKernel.
+typedef struct {
+  size_t local_size[3];
+} opencl_launch_config;
+
+/**
+ * Enqueue one launch of the kernel being tuned with the given configuration. It is called
+ * several times for each candidate, so the launch must be safe to repeat.
+ * @param config Candidate configuration.
+ * @param data Pointer given to opencl_tune.
+ * @return The error of clEnqueueNDRangeKernel. Errors from an unfit local size skip the
+ * candidate, any other error stops the tuning.
+ */
+typedef cl_int (*opencl_tune_launch)(const opencl_launch_config* config, void* data);
+
+/**
+ * Find the fastest local size of a kernel on the device of the queue. The candidates
+ * are the powers of two allowed for the kernel on the device, and the choice of the
+ * implementation. The result is cached in the file
+ * "launch_configs" of the openclutils cache directory, see opencl_cache_path, keyed by
+ * the device name, the driver version and a hash of the program binary, build options,
+ * kernel name and problem, so later runs find it without timing anything. There is no cost at launch time either way.
+ * @param queue Command queue of the device, in order.
+ * @param kernel Kernel to tune, with its arguments set unless the launch callback sets them.
+ * @param dims Number of dimensions of the launch, 1 to 3.
+ * @param problem Description of the problem, such as its size, as part of the cache key.
+ * @param launch Callback that enqueues one launch.
+ * @param data Pointer passed to the callback.
+ * @param config Fastest configuration found.
+ * @return True on success, false on failure.
+ */
+bool opencl_tune(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const char* problem,
+                 opencl_tune_launch launch, void* data, opencl_launch_config* config);
+
+/**
+ * Tune the local size of a kernel with a fixed global size, so only the local sizes that
+ * divide it are candidates. The arguments of the kernel must be set.
+ * @param queue Command queue of the device, in order.
+ * @param kernel Kernel to tune.
+ * @param dims Number of dimensions of the launch, 1 to 3.
+ * @param global_size Global size of the launch.
+ * @param config Fastest configuration found.
+ * @return True on success, false on failure.
+ */
+bool opencl_tune_kernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t* global_size,
+                        opencl_launch_config* config);
+
+/**
+ * Local size to pass to clEnqueueNDRangeKernel for a tuned configuration.
+ * @param config Tuned configuration.
+ * @return The local size, or NULL for the choice of the implementation.
+ */
+static inline const size_t* opencl_local_size(const opencl_launch_config* config) {
+   return config->local_size[0] == 0 ? NULL : config->local_size;
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "opencl_utils.h"
+#include "opencl_cache.h"
 
 #include <CL/cl.h>
 #include <stdbool.h>
@@ -7,12 +8,14 @@
 #include <stdint.h>
 #include <string.h>
 
-#define MAX_BUILD_LOG_SIZE 2048
 #define MAX_KERNEL_NAME_SIZE 256
 
 // This is anything but thread-safe.
 static cl_int opencl_error;
 
+static char* read_source_file(const char* filename);
+static bool print_build_log(cl_program program, cl_device_id device, cl_uint index);
+
 
 bool opencl_discover(opencl_handle* handle, cl_device_type type) {
   cl_platform_id* platforms = NULL;
@@ -114,28 +117,9 @@ bool opencl_free(opencl_handle* handle) {
 
 
 bool opencl_load_source_file(const char* filename, cl_context context, cl_program* program) {
-  FILE* source_fid;
-  char* source = NULL;
-  long source_length;
-
-  source_fid = fopen(filename, "r");
-  if (source_fid == NULL) {
-    printf("Opening kernel source file %s failed!\n", filename);
+  char* source = read_source_file(filename);
+  if (source == NULL)
     return false;
-  }
-  fseek(source_fid, 0, SEEK_END);
-  source_length = ftell(source_fid);
-  fseek(source_fid, 0, SEEK_SET);
-
-  // Add a byte for null character:
-  source = (char*) malloc(source_length + 1);
-  if (source == NULL) {
-    printf("Out of memory!\n");
-    return false;
-  }
-  fread(source, source_length, 1, source_fid);
-  source[source_length] = '\0';
-  fclose(source_fid);
 
   // File reading is now done, let's create a program:
   *program = clCreateProgramWithSource(context, 1, (const char**) &source, NULL, &opencl_error);
@@ -146,10 +130,54 @@ bool opencl_load_source_file(const char* filename, cl_context context, cl_progra
   return true;
 }
 
-cl_int opencl_build_kernels(opencl_handle* handle, cl_program program, const char* options, bool verbose) {
-   size_t n_kernels;
-   cl_uint n_created;
+bool opencl_build_program(cl_context context, cl_uint n_devices, const cl_device_id* devices, cl_uint count,
+                          const char** strings, const size_t* lengths, const char* options, cl_program* program) {
+   uint64_t key;
+   char* path = NULL;
+
+   opencl_error = opencl_cache_key(n_devices, devices, count, strings, lengths, options, &key);
+   OPENCL_CHECK(opencl_error);
+   path = opencl_cache_program_path("openclutils", key);
+   if (path != NULL) {
+      *program = opencl_cache_load(context, n_devices, devices, path, key, options);
+      if (*program != NULL) {
+         free(path);
+         return true;
+      }
+   }
+
+   *program = clCreateProgramWithSource(context, count, strings, lengths, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   opencl_error = clBuildProgram(*program, n_devices, devices, options, NULL, NULL);
+   if (opencl_error != CL_SUCCESS) {
+      printf("Build error! Return code %d.\n", opencl_error);
+      for (cl_uint d = 0; d < n_devices; d++)
+         print_build_log(*program, devices[d], d);
+      free(path);
+      return false;
+   }
 
+   if (path != NULL)
+      opencl_cache_store(*program, n_devices, devices, path, key);
+   free(path);
+
+   return true;
+}
+
+bool opencl_build_source_file(opencl_handle* handle, const char* filename, const char* options,
+                              cl_program* program) {
+   char* source = read_source_file(filename);
+   if (source == NULL)
+      return false;
+
+   bool built = opencl_build_program(handle->context, handle->n_devices, handle->devices, 1,
+                                     (const char**) &source, NULL, options, program);
+   free(source);
+
+   return built;
+}
+
+cl_int opencl_build_kernels(opencl_handle* handle, cl_program program, const char* options, bool verbose) {
    opencl_error = clBuildProgram(program, 0, NULL, options, NULL, NULL);
    if (opencl_error != CL_SUCCESS) {
       printf("Build error! Return code %d.\n", opencl_error);
@@ -158,18 +186,12 @@ cl_int opencl_build_kernels(opencl_handle* handle, cl_program program, const cha
       return -1;
    }
 
-//   if (verbose) {
-//      TODO need to figure out device IDs, blaah
-//      char* log = (char*) malloc(MAX_BUILD_LOG_SIZE + 1);
-//      opencl_error = clGetProgramBuildInfo(program, f, CL_PROGRAM_BUILD_LOG, MAX_BUILD_LOG_SIZE, log, NULL);
-//      if (opencl_error != CL_SUCCESS) {
-//         printf("Failed to get the build log! Error code %d.\n", opencl_error);
-//         return -1;
-//      }
-//      log[MAX_BUILD_LOG_SIZE] = '\0';
-//      printf("Build log for device x: %s\n", log);
-//      free(log);
-//   }
+   return opencl_create_kernels(handle, program, verbose);
+}
+
+cl_int opencl_create_kernels(opencl_handle* handle, cl_program program, bool verbose) {
+   size_t n_kernels;
+   cl_uint n_created;
 
    opencl_error = clGetProgramInfo(program, CL_PROGRAM_NUM_KERNELS, sizeof(size_t), &n_kernels, NULL);
    if (opencl_error != CL_SUCCESS) {
@@ -190,6 +212,14 @@ cl_int opencl_build_kernels(opencl_handle* handle, cl_program program, const cha
    }
    handle->n_kernels = n_created;
 
+   if (verbose) {
+      printf("Created %u kernels.\n", n_created);
+      for (cl_uint d = 0; d < handle->n_devices; d++) {
+         if (!print_build_log(program, handle->devices[d], d))
+            return -1;
+      }
+   }
+
    return n_created;
 }
 
@@ -216,3 +246,59 @@ void _display_opencl_error(cl_uint x)
   printf("OpenCL error %d!\n", x);
   return;
 }
+
+
+
+static char* read_source_file(const char* filename) {
+  FILE* source_fid;
+  char* source = NULL;
+  long source_length;
+
+  source_fid = fopen(filename, "r");
+  if (source_fid == NULL) {
+    printf("Opening kernel source file %s failed!\n", filename);
+    return NULL;
+  }
+  fseek(source_fid, 0, SEEK_END);
+  source_length = ftell(source_fid);
+  fseek(source_fid, 0, SEEK_SET);
+
+  // Add a byte for null character:
+  source = (char*) malloc(source_length + 1);
+  if (source == NULL) {
+    printf("Out of memory!\n");
+    return NULL;
+  }
+  fread(source, source_length, 1, source_fid);
+  source[source_length] = '\0';
+  fclose(source_fid);
+
+  return source;
+}
+
+
+// The size is queried first, as the logs of failed builds can be long.
+static bool print_build_log(cl_program program, cl_device_id device, cl_uint index) {
+   size_t size;
+
+   opencl_error = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+   if (opencl_error != CL_SUCCESS) {
+      printf("Failed to get the build log! Error code %d.\n", opencl_error);
+      return false;
+   }
+   char* log = (char*) malloc(size);
+   if (log == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   opencl_error = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, size, log, NULL);
+   if (opencl_error != CL_SUCCESS) {
+      printf("Failed to get the build log! Error code %d.\n", opencl_error);
+      free(log);
+      return false;
+   }
+   printf("Build log for device %u: %s\n", index, log);
+   free(log);
+
+   return true;
+}
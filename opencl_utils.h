@@ -57,17 +57,58 @@ bool opencl_free(opencl_handle* handle);
  */
 bool opencl_load_source_file(const char* filename, cl_context context, cl_program* program);
 
+/**
+ * Create and build a program for the devices, from the binaries cached by an earlier
+ * build if there are any, otherwise from source. The binaries are cached under a hash
+ * of the source, the build options, and the name, vendor, version and driver version
+ * of each device, so that a change in any of them builds from source again. Cached
+ * binaries that fail to load or build are rebuilt from source and replaced.
+ * @param context OpenCL context in which the program will be executed.
+ * @param n_devices Number of devices to build for.
+ * @param devices The devices, in the context.
+ * @param count Number of source strings.
+ * @param strings Source strings, concatenated as in clCreateProgramWithSource.
+ * @param lengths Lengths of the strings, or NULL if they are null-terminated.
+ * @param options Build options.
+ * @param program Will be updated to contain the built program.
+ * @return True on success, false on failure.
+ */
+bool opencl_build_program(cl_context context, cl_uint n_devices, const cl_device_id* devices, cl_uint count,
+                          const char** strings, const size_t* lengths, const char* options, cl_program* program);
+
+/**
+ * Load OpenCL kernel source from file, and build it for all devices of the handle with
+ * opencl_build_program, so that later runs load the cached binaries instead.
+ * @param handle OpenCL handle with the context and the devices.
+ * @param filename File containing the source code.
+ * @param options Build options.
+ * @param program Will be updated to contain the built program.
+ * @return True on success, false on failure.
+ */
+bool opencl_build_source_file(opencl_handle* handle, const char* filename, const char* options,
+                              cl_program* program);
+
 /**
  * Build the OpenCL program with given build options and create kernel objects
  * for all kernels contained in the program.
  * @param handle OpenCL handle for storing the kernels
  * @param program OpenCL program containing the kernels.
  * @param options Build options.
- * @param verbose Print the number of kernels and build information.
+ * @param verbose Print the number of kernels and the build log of each device.
  * @return The number of kernels, or -1 on failure.
  */
 cl_int opencl_build_kernels(opencl_handle* handle, cl_program program, const char* options, bool verbose);
 
+/**
+ * Create kernel objects for all kernels of a program that is already built, such as
+ * one from opencl_build_program.
+ * @param handle OpenCL handle for storing the kernels
+ * @param program OpenCL program containing the kernels.
+ * @param verbose Print the number of kernels and the build log of each device.
+ * @return The number of kernels, or -1 on failure.
+ */
+cl_int opencl_create_kernels(opencl_handle* handle, cl_program program, bool verbose);
+
 
 /**
  * Find the kernel with the given name in the list of created kernels.
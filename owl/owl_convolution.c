@@ -0,0 +1,232 @@
+#include "owl_convolution.h"
+#include "owl_errno.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int enqueue_product(owl_convolution* convolution, bool conjugate);
+static int convolve(owl_convolution* convolution, const void* signal, void* output, bool correlate);
+static int convolve_enqueue(owl_convolution* convolution, cl_mem signal, cl_mem output, bool correlate,
+                            cl_uint num_events, const cl_event* wait_list, cl_event* event);
+
+owl_convolution* owl_convolution_alloc(owl_fft_handle* handle, size_t signal_n, size_t filter_n) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+
+   if (signal_n == 0 || filter_n == 0)
+      OWL_ERROR_NULL("empty signal or filter", OWL_EINVAL);
+
+   owl_convolution* convolution = calloc(sizeof(owl_convolution), 1);
+   if (convolution == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   convolution->fft = handle;
+   convolution->signal_n = signal_n;
+   convolution->filter_n = filter_n;
+   convolution->n = 1;
+   while (convolution->n < signal_n + filter_n - 1)
+      convolution->n *= 2;
+
+   const size_t buffer_size = 2*convolution->n*handle->real_size;
+
+   convolution->wavetable = owl_fft_complex_wavetable_alloc(handle, convolution->n);
+   if (convolution->wavetable == NULL)
+      return NULL;
+
+   convolution->workspace = owl_fft_complex_workspace_alloc(handle, convolution->n);
+   if (convolution->workspace == NULL)
+      return NULL;
+
+   convolution->multiply_kernel = clCreateKernel(handle->program, "owl_fft_multiply", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   convolution->filter = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE, buffer_size, NULL, &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   convolution->spectrum = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE, buffer_size, NULL, &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   // The padding is zeroed once here. The transforms only read the signal buffer,
+   // and later signals only overwrite its first signal_n points.
+   void* zeros = calloc(buffer_size, 1);
+   if (zeros == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   convolution->signal = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, buffer_size,
+                                        zeros, &opencl_error);
+   free(zeros);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   return convolution;
+}
+
+void owl_convolution_free(owl_convolution* convolution) {
+   cl_int opencl_error;
+
+   owl_fft_complex_wavetable_free(convolution->wavetable);
+   owl_fft_complex_workspace_free(convolution->workspace);
+
+   opencl_error = clReleaseKernel(convolution->multiply_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseMemObject(convolution->filter);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseMemObject(convolution->signal);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseMemObject(convolution->spectrum);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   free(convolution);
+}
+
+
+int owl_convolution_set_filter(owl_convolution* convolution, const void* filter) {
+   cl_int opencl_error;
+   owl_fft_handle* fft = convolution->fft;
+   const size_t point_size = 2*fft->real_size;
+
+   void* padded = calloc(convolution->n, point_size);
+   if (padded == NULL)
+      OWL_ERROR("out of memory", OWL_NOMEM);
+   memcpy(padded, filter, convolution->filter_n*point_size);
+
+   opencl_error = clEnqueueWriteBuffer(fft->opencl->queues[0], convolution->filter, CL_TRUE, 0,
+                                       convolution->n*point_size, padded, 0, NULL, NULL);
+   free(padded);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   // The transform reads its input only in the first pass, so it can be done in place.
+   return owl_fft_complex_forward_enqueue(fft, convolution->filter, convolution->filter, convolution->n, 1,
+                                          convolution->wavetable, convolution->workspace, 0, NULL, NULL);
+}
+
+
+int owl_convolve(owl_convolution* convolution, const void* signal, void* output) {
+   return convolve(convolution, signal, output, false);
+}
+
+int owl_correlate(owl_convolution* convolution, const void* signal, void* output) {
+   return convolve(convolution, signal, output, true);
+}
+
+int owl_convolve_enqueue(owl_convolution* convolution, cl_mem signal, cl_mem output,
+                         cl_uint num_events, const cl_event* wait_list, cl_event* event) {
+   return convolve_enqueue(convolution, signal, output, false, num_events, wait_list, event);
+}
+
+int owl_correlate_enqueue(owl_convolution* convolution, cl_mem signal, cl_mem output,
+                          cl_uint num_events, const cl_event* wait_list, cl_event* event) {
+   return convolve_enqueue(convolution, signal, output, true, num_events, wait_list, event);
+}
+
+
+// The circular correlation has the negative lags at the end of the buffer, so the
+// result is read in two pieces to put them first.
+static int convolve(owl_convolution* convolution, const void* signal, void* output, bool correlate) {
+   cl_int opencl_error;
+   cl_command_queue queue = convolution->fft->opencl->queues[0];
+   const size_t point_size = 2*convolution->fft->real_size;
+   const size_t lags = correlate ? convolution->filter_n - 1 : 0;
+
+   opencl_error = clEnqueueWriteBuffer(queue, convolution->signal, CL_FALSE, 0, convolution->signal_n*point_size,
+                                       signal, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_product(convolution, correlate);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   if (lags > 0) {
+      opencl_error = clEnqueueReadBuffer(queue, convolution->spectrum, CL_FALSE, (convolution->n - lags)*point_size,
+                                         lags*point_size, output, 0, NULL, NULL);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+   }
+
+   opencl_error = clEnqueueReadBuffer(queue, convolution->spectrum, CL_TRUE, 0,
+                                      (convolution->signal_n + convolution->filter_n - 1 - lags)*point_size,
+                                      (char*)output + lags*point_size, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+static int convolve_enqueue(owl_convolution* convolution, cl_mem signal, cl_mem output, bool correlate,
+                            cl_uint num_events, const cl_event* wait_list, cl_event* event) {
+   cl_int opencl_error;
+   cl_command_queue queue = convolution->fft->opencl->queues[0];
+   const size_t point_size = 2*convolution->fft->real_size;
+   const size_t lags = correlate ? convolution->filter_n - 1 : 0;
+
+   opencl_error = clEnqueueCopyBuffer(queue, signal, convolution->signal, 0, 0, convolution->signal_n*point_size,
+                                      num_events, wait_list, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_product(convolution, correlate);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   if (lags > 0) {
+      opencl_error = clEnqueueCopyBuffer(queue, convolution->spectrum, output, (convolution->n - lags)*point_size, 0,
+                                         lags*point_size, 0, NULL, NULL);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+   }
+
+   opencl_error = clEnqueueCopyBuffer(queue, convolution->spectrum, output, 0, lags*point_size,
+                                      (convolution->signal_n + convolution->filter_n - 1 - lags)*point_size,
+                                      0, NULL, event);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+// Forward transform of the signal, product with the cached filter spectrum and
+// inverse transform, all in the spectrum buffer.
+static int enqueue_product(owl_convolution* convolution, bool conjugate) {
+   cl_int opencl_error;
+   owl_fft_handle* fft = convolution->fft;
+   const cl_uint conjugate_arg = conjugate;
+   const size_t global_work_size = convolution->n;
+
+   opencl_error = owl_fft_complex_forward_enqueue(fft, convolution->signal, convolution->spectrum, convolution->n, 1,
+                                                  convolution->wavetable, convolution->workspace, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   opencl_error = clSetKernelArg(convolution->multiply_kernel, 0, sizeof(cl_mem), (void*)&convolution->spectrum);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(convolution->multiply_kernel, 1, sizeof(cl_mem), (void*)&convolution->filter);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(convolution->multiply_kernel, 2, sizeof(cl_uint), (void*)&conjugate_arg);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clEnqueueNDRangeKernel(fft->opencl->queues[0], convolution->multiply_kernel, 1, NULL,
+                                         &global_work_size, NULL, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return owl_fft_complex_inverse_enqueue(fft, convolution->spectrum, convolution->spectrum, convolution->n, 1,
+                                          convolution->wavetable, convolution->workspace, 0, NULL, NULL);
+}
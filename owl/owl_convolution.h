@@ -0,0 +1,64 @@
+/*
+ * Convolutions and correlations with the FFT.
+ */
+
+#ifndef OWL_CONVOLUTION_H
+#define OWL_CONVOLUTION_H
+
+#include "owl_fft.h"
+
+#include <CL/cl.h>
+
+// Linear convolutions of signals of signal_n points with a filter of filter_n points,
+// done as circular ones of a power of two n >= signal_n + filter_n - 1. The spectrum
+// of the filter is kept on the device and reused by every call.
+typedef struct {
+   owl_fft_handle* fft;
+   size_t n;                                 // transform size
+   size_t signal_n;
+   size_t filter_n;
+   owl_fft_complex_wavetable* wavetable;
+   owl_fft_complex_workspace* workspace;
+   cl_kernel multiply_kernel;
+   cl_mem filter;                            // spectrum of the zero padded filter
+   cl_mem signal;                            // zero padded signal
+   cl_mem spectrum;                          // spectrum of the signal, and then the result
+} owl_convolution;
+
+
+owl_convolution* owl_convolution_alloc(owl_fft_handle* handle, size_t signal_n, size_t filter_n);
+void owl_convolution_free(owl_convolution* convolution);
+
+/**
+ * Transform the filter and keep its spectrum for the following calls.
+ * @param filter filter_n complex values.
+ */
+int owl_convolution_set_filter(owl_convolution* convolution, const void* filter);
+
+/**
+ * Convolve a signal with the filter. The signal is uploaded and the result downloaded,
+ * everything in between stays on the device.
+ * @param signal signal_n complex values.
+ * @param output Room for signal_n + filter_n - 1 complex values.
+ */
+int owl_convolve(owl_convolution* convolution, const void* signal, void* output);
+
+/**
+ * Cross-correlation output[j] = sum_t signal[t + j - filter_n + 1] conj(filter[t]),
+ * so that output[filter_n - 1] is the zero lag.
+ */
+int owl_correlate(owl_convolution* convolution, const void* signal, void* output);
+
+/**
+ * Enqueue a convolution between device buffers without blocking, like
+ * owl_fft_complex_forward_enqueue.
+ * @param signal Device buffer holding signal_n complex values.
+ * @param output Device buffer with room for signal_n + filter_n - 1 complex values.
+ */
+int owl_convolve_enqueue(owl_convolution* convolution, cl_mem signal, cl_mem output,
+                         cl_uint num_events, const cl_event* wait_list, cl_event* event);
+
+int owl_correlate_enqueue(owl_convolution* convolution, cl_mem signal, cl_mem output,
+                          cl_uint num_events, const cl_event* wait_list, cl_event* event);
+
+#endif
@@ -1,13 +1,68 @@
 #include "owl_fft.h"
 #include "owl_opencl.h"
 #include "owl_errno.h"
+#include "opencl_device.h"
 
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 // Kernel sources
 #include "owl_fft.cl.hex"
 
-owl_fft_handle* owl_fft_init(owl_opencl_handle* opencl) {
+// Strided data is copied with the points in between and packed on the device as long as
+// that copies at most this many times the points themselves, and point by point beyond.
+#define MAX_GATHER_STRIDE 16
+
+typedef enum {
+   OWL_FFT_FORWARD,
+   OWL_FFT_BACKWARD
+} owl_fft_direction;
+
+// Commands of one transform are chained by the in-order queue. Only the first one
+// waits for the events of the caller and only the last one signals its event.
+typedef struct {
+   cl_uint num_events;
+   const cl_event* wait_list;
+   cl_event* event;
+} owl_fft_events;
+
+static cl_kernel radix_kernel(owl_fft_handle* handle, cl_uint radix);
+static int transform_batch(owl_fft_handle* handle, void* data, size_t stride, size_t n, size_t howmany, size_t dist,
+                           const owl_fft_complex_wavetable* wavetable,
+                           owl_fft_complex_workspace* workspace, owl_fft_direction direction);
+static int enqueue_transform(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                             owl_fft_complex_workspace* workspace, size_t howmany,
+                             owl_fft_direction direction, cl_uint* buffer, owl_fft_events* events);
+static int enqueue_bluestein(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                             cl_mem input, cl_mem output, const cl_mem* scratch, size_t howmany,
+                             owl_fft_direction direction, owl_fft_events* events);
+static int bluestein_wavetable(owl_fft_handle* handle, owl_fft_complex_wavetable* wavetable);
+static int enqueue_passes(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                          cl_mem input, cl_mem output, const cl_mem* scratch, size_t howmany,
+                          owl_fft_direction direction, owl_fft_events* events);
+static int enqueue_device(owl_fft_handle* handle, cl_mem input, cl_mem output, size_t n, size_t howmany,
+                          const owl_fft_complex_wavetable* wavetable, owl_fft_complex_workspace* workspace,
+                          owl_fft_direction direction, cl_uint num_events, const cl_event* wait_list,
+                          cl_event* event);
+static cl_int enqueue_kernel(owl_fft_handle* handle, cl_kernel kernel, const size_t* global_work_size,
+                             const size_t* local_work_size, owl_fft_events* events, bool last);
+static int enqueue_transpose(owl_fft_handle* handle, cl_mem data, cl_mem output, size_t rows, size_t cols);
+static int enqueue_strided(owl_fft_handle* handle, cl_kernel kernel, cl_mem data, cl_mem output, size_t n,
+                           size_t howmany, size_t stride, size_t dist);
+static int transform_nd(owl_fft_handle* handle, void* data, const owl_fft_complex_wavetable_nd* wavetable,
+                        owl_fft_complex_workspace* workspace, owl_fft_direction direction);
+static int enqueue_inplace(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                           cl_mem buffer, size_t howmany, cl_double2 pre, cl_double2 post,
+                           owl_fft_events* events);
+static size_t local_work_size(owl_fft_handle* handle, size_t local_n);
+static cl_mem create_table(owl_fft_handle* handle, cl_mem_flags flags, const double* values, size_t n,
+                           cl_int* opencl_error);
+static cl_int set_complex_arg(owl_fft_handle* handle, cl_kernel kernel, cl_uint index, cl_double2 value);
+
+owl_fft_handle* owl_fft_init(owl_opencl_handle* opencl, owl_fft_precision precision) {
    cl_int opencl_error;
 
    owl_fft_handle* handle = calloc(sizeof(owl_fft_handle), 1);
@@ -15,23 +70,138 @@ owl_fft_handle* owl_fft_init(owl_opencl_handle* opencl) {
       OWL_ERROR_NULL("out of memory", OWL_NOMEM);
 
    handle->opencl = opencl;
+   handle->precision = precision;
+   handle->real_size = precision == OWL_FFT_DOUBLE ? sizeof(cl_double) : sizeof(cl_float);
 
-   // Passing &owl_fft_cl does not work, some fiddling required here.
-   const char* source = owl_fft_cl;
-   handle->program = clCreateProgramWithSource(opencl->context, 1, &source, &owl_fft_cl_len, &opencl_error);
+   if (precision == OWL_FFT_DOUBLE && !opencl_device_has_fp64(opencl->devices[0]))
+      OWL_ERROR_NULL("the device does not support double precision", OWL_EINVAL);
+
+   // Should the kernel building be postponed to the planning phase, in case it depends on the transfer size?
+   // Double precision is asked for accuracy, so it is built without the unsafe optimizations.
+   // Later runs load the binary of the first build.
+   const char* options = precision == OWL_FFT_DOUBLE ? "-DOWL_FFT_DOUBLE" : "-cl-unsafe-math-optimizations";
+   if (owl_opencl_build_program(opencl, owl_fft_cl, owl_fft_cl_len, options, &handle->program) != OWL_SUCCESS)
+      return NULL;
+
+   handle->radix2_kernel = clCreateKernel(handle->program, "owl_fft_radix2", &opencl_error);
    if (opencl_error != CL_SUCCESS)
       OWL_ERROR_NULL(NULL, opencl_error);
 
-   // TODO think about the build options
-   // Should the kernel building be postponed to the planning phase, in case it depends on the transfer size?
-   opencl_error = clBuildProgram(handle->program, 1, opencl->devices, "-cl-unsafe-math-optimizations", NULL, NULL);
+   handle->radix4_kernel = clCreateKernel(handle->program, "owl_fft_radix4", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->radix8_kernel = clCreateKernel(handle->program, "owl_fft_radix8", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->local_kernel = clCreateKernel(handle->program, "owl_fft_local", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->bitreverse_kernel = clCreateKernel(handle->program, "owl_fft_bitreverse", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->local_inplace_kernel = clCreateKernel(handle->program, "owl_fft_local_inplace", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->inplace_kernel = clCreateKernel(handle->program, "owl_fft_inplace", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->r2c_kernel = clCreateKernel(handle->program, "owl_fft_r2c_post", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->c2r_kernel = clCreateKernel(handle->program, "owl_fft_c2r_pre", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->transpose_kernel = clCreateKernel(handle->program, "owl_fft_transpose", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->gather_kernel = clCreateKernel(handle->program, "owl_fft_gather", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->scatter_kernel = clCreateKernel(handle->program, "owl_fft_scatter", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->bluestein_pre_kernel = clCreateKernel(handle->program, "owl_fft_bluestein_pre", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->bluestein_multiply_kernel = clCreateKernel(handle->program, "owl_fft_bluestein_multiply", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   handle->bluestein_post_kernel = clCreateKernel(handle->program, "owl_fft_bluestein_post", &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   // The local memory kernels keep two copies of the data for ping-ponging, in the local
+   // memory left by their own variables. Before the __local arguments are set, the kernel
+   // query only counts the local memory the kernel declares itself.
+   cl_ulong local_mem_size, kernel_local_size, inplace_local_size;
+   opencl_error = clGetDeviceInfo(opencl->devices[0], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong),
+                                  &local_mem_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   opencl_error = clGetKernelWorkGroupInfo(handle->local_kernel, opencl->devices[0], CL_KERNEL_LOCAL_MEM_SIZE,
+                                           sizeof(cl_ulong), &kernel_local_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   opencl_error = clGetKernelWorkGroupInfo(handle->local_inplace_kernel, opencl->devices[0], CL_KERNEL_LOCAL_MEM_SIZE,
+                                           sizeof(cl_ulong), &inplace_local_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+   if (inplace_local_size > kernel_local_size)
+      kernel_local_size = inplace_local_size;
+
+   handle->max_local_n = 1;
+   while (kernel_local_size + 8*handle->max_local_n*handle->real_size <= local_mem_size)
+      handle->max_local_n *= 2;
+
+   size_t kernel_wg_size, inplace_wg_size;
+   opencl_error = clGetKernelWorkGroupInfo(handle->local_kernel, opencl->devices[0], CL_KERNEL_WORK_GROUP_SIZE,
+                                           sizeof(size_t), &kernel_wg_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   opencl_error = clGetKernelWorkGroupInfo(handle->local_inplace_kernel, opencl->devices[0], CL_KERNEL_WORK_GROUP_SIZE,
+                                           sizeof(size_t), &inplace_wg_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+   if (inplace_wg_size < kernel_wg_size)
+      kernel_wg_size = inplace_wg_size;
+
+   // The kernel does not need a power of two, but it keeps the work evenly distributed.
+   handle->local_work_size = 1;
+   while (2*handle->local_work_size <= kernel_wg_size)
+      handle->local_work_size *= 2;
+
+   // Square tiles of up to 16 x 16 points for the transposes
+   opencl_error = clGetKernelWorkGroupInfo(handle->transpose_kernel, opencl->devices[0], CL_KERNEL_WORK_GROUP_SIZE,
+                                           sizeof(size_t), &kernel_wg_size, NULL);
    if (opencl_error != CL_SUCCESS)
       OWL_ERROR_NULL(NULL, opencl_error);
 
-   handle->fft_kernel = clCreateKernel(handle->program, "owl_fft_radix2", &opencl_error);
+   opencl_error = clGetKernelWorkGroupInfo(handle->transpose_kernel, opencl->devices[0], CL_KERNEL_LOCAL_MEM_SIZE,
+                                           sizeof(cl_ulong), &kernel_local_size, NULL);
    if (opencl_error != CL_SUCCESS)
       OWL_ERROR_NULL(NULL, opencl_error);
 
+   handle->tile_size = 1;
+   while (handle->tile_size < 16 && 4*handle->tile_size*handle->tile_size <= kernel_wg_size &&
+          kernel_local_size + 2*handle->real_size*(2*handle->tile_size)*(2*handle->tile_size + 1) <= local_mem_size)
+      handle->tile_size *= 2;
+
    return handle;
 }
 
@@ -39,7 +209,63 @@ owl_fft_handle* owl_fft_init(owl_opencl_handle* opencl) {
 void owl_fft_free(owl_fft_handle* handle) {
    cl_int opencl_error;
 
-   opencl_error = clReleaseKernel(handle->fft_kernel);
+   opencl_error = clReleaseKernel(handle->radix2_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->radix4_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->radix8_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->local_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->bitreverse_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->local_inplace_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->inplace_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->r2c_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->c2r_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->transpose_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->gather_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->scatter_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->bluestein_pre_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->bluestein_multiply_kernel);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseKernel(handle->bluestein_post_kernel);
    if (opencl_error != CL_SUCCESS)
       OWL_ERROR_VOID(NULL, opencl_error);
 
@@ -51,9 +277,261 @@ void owl_fft_free(owl_fft_handle* handle) {
 }
 
 
+owl_fft_complex_wavetable* owl_fft_complex_wavetable_alloc(owl_fft_handle* handle, size_t n) {
+   cl_int opencl_error;
+   cl_uint p = 1;
+
+   if (n == 0 || n > UINT32_MAX/4)
+      OWL_ERROR_NULL("unsupported transform size", OWL_EINVAL);
+
+   owl_fft_complex_wavetable* wavetable = calloc(sizeof(owl_fft_complex_wavetable), 1);
+   if (wavetable == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   wavetable->n = n;
+   wavetable->workspace_n = n;
+
+   if ((n & (n - 1)) != 0) {
+      if (bluestein_wavetable(handle, wavetable) != 0)
+         return NULL;
+      return wavetable;
+   }
+
+   wavetable->local_n = n < handle->max_local_n ? n : handle->max_local_n;
+
+   const size_t global_n = n / wavetable->local_n;
+   size_t m = global_n;
+
+   // Use radix 8 as long as possible, and finish with one radix 4 or 2 pass.
+   while (m > 1) {
+      cl_uint radix = 8;
+      while (m % radix != 0)
+         radix >>= 1;
+
+      wavetable->factor[wavetable->nf] = radix;
+      wavetable->nf += 1;
+      m /= radix;
+   }
+
+   // Precompute in double precision to keep the tables accurate also for long transforms.
+   // Pass with sub-FFT length p and radix r needs w_{pr}^(jk) for j = 1..r-1, k < p.
+   // The passes before it take sum (r_i - 1)*p_i = p - 1 values, which is where its twiddles start,
+   // and the whole table has global_n - 1 values.
+   double* twiddle = malloc(2*n*sizeof(double));
+   if (twiddle == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   for (cl_uint f = 0; f < wavetable->nf; f++) {
+      const cl_uint radix = wavetable->factor[f];
+      double* pass_twiddle = twiddle + 2*(p - 1);
+
+      for (cl_uint j = 1; j < radix; j++) {
+         for (cl_uint k = 0; k < p; k++) {
+            const double alpha = -2.0*M_PI*(double)(j*k) / (double)(p*radix);
+            pass_twiddle[2*((j - 1)*p + k)]     = cos(alpha);
+            pass_twiddle[2*((j - 1)*p + k) + 1] = sin(alpha);
+         }
+      }
+      p *= radix;
+   }
+
+   // Allocate global_n values instead of global_n - 1, buffers of size zero are not allowed.
+   wavetable->twiddle = create_table(handle, CL_MEM_READ_ONLY, twiddle, global_n, &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   // The twiddle buffer is always large enough for the roots of unity as well.
+   for (size_t i = 0; i < n; i++) {
+      const double alpha = -2.0*M_PI*(double)i / (double)n;
+      twiddle[2*i]     = cos(alpha);
+      twiddle[2*i + 1] = sin(alpha);
+   }
+
+   wavetable->trig = create_table(handle, CL_MEM_READ_ONLY, twiddle, n, &opencl_error);
+   free(twiddle);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   return wavetable;
+}
+
+void owl_fft_complex_wavetable_free(owl_fft_complex_wavetable* wavetable) {
+   cl_int opencl_error;
+
+   if (wavetable->bluestein != NULL) {
+      owl_fft_complex_wavetable_free(wavetable->bluestein);
+
+      opencl_error = clReleaseMemObject(wavetable->chirp);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR_VOID(NULL, opencl_error);
+
+      opencl_error = clReleaseMemObject(wavetable->filter);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR_VOID(NULL, opencl_error);
+
+      free(wavetable);
+      return;
+   }
+
+   opencl_error = clReleaseMemObject(wavetable->twiddle);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   opencl_error = clReleaseMemObject(wavetable->trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   free(wavetable);
+}
+
+
+// Chirp c[t] = w_{2n}^(t^2) and the spectrum of the convolution filter b[t] = conj(c[t]),
+// b[m - t] = b[t], t < n, zero elsewhere. t^2 is reduced modulo 2n to keep the angles accurate.
+static int bluestein_wavetable(owl_fft_handle* handle, owl_fft_complex_wavetable* wavetable) {
+   cl_int opencl_error;
+   const size_t n = wavetable->n;
+   size_t m = 1;
+
+   while (m < 2*n - 1)
+      m *= 2;
+
+   wavetable->workspace_n = m;
+   wavetable->bluestein = owl_fft_complex_wavetable_alloc(handle, m);
+   if (wavetable->bluestein == NULL)
+      return OWL_NOMEM;
+
+   double* chirp = malloc(2*n*sizeof(double));
+   double* filter = calloc(2*m, sizeof(double));
+   if (chirp == NULL || filter == NULL)
+      OWL_ERROR("out of memory", OWL_NOMEM);
+
+   for (size_t t = 0; t < n; t++) {
+      const double alpha = -M_PI*(double)((uint64_t)t*t % (2*n)) / (double)n;
+      chirp[2*t]     = cos(alpha);
+      chirp[2*t + 1] = sin(alpha);
+
+      filter[2*t]     =  cos(alpha) / m;
+      filter[2*t + 1] = -sin(alpha) / m;
+      if (t > 0) {
+         filter[2*(m - t)]     = filter[2*t];
+         filter[2*(m - t) + 1] = filter[2*t + 1];
+      }
+   }
+
+   wavetable->chirp = create_table(handle, CL_MEM_READ_ONLY, chirp, n, &opencl_error);
+   free(chirp);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   // The spectrum is computed on the device with the m-point plan, ping-ponging between two buffers.
+   owl_fft_complex_workspace workspace = {m, {NULL, NULL}};
+   workspace.buffers[0] = create_table(handle, CL_MEM_READ_WRITE, filter, m, &opencl_error);
+   free(filter);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   workspace.buffers[1] = clCreateBuffer(handle->opencl->context, CL_MEM_READ_WRITE, 2*m*handle->real_size,
+                                         NULL, &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   cl_uint result = 0;
+   opencl_error = enqueue_transform(handle, wavetable->bluestein, &workspace, 1, OWL_FFT_FORWARD, &result, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   // Releasing the other buffer is deferred until the queued passes are done with it.
+   wavetable->filter = workspace.buffers[result];
+   opencl_error = clReleaseMemObject(workspace.buffers[1 - result]);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+owl_fft_real_wavetable* owl_fft_real_wavetable_alloc(owl_fft_handle* handle, size_t n) {
+   cl_int opencl_error;
+   const size_t half_n = n/2;
+
+   if (n < 2 || n % 2 != 0)
+      OWL_ERROR_NULL("n must be even", OWL_EINVAL);
+
+   owl_fft_real_wavetable* wavetable = calloc(sizeof(owl_fft_real_wavetable), 1);
+   if (wavetable == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   wavetable->n = n;
+   wavetable->complex = owl_fft_complex_wavetable_alloc(handle, half_n);
+   if (wavetable->complex == NULL)
+      return NULL;
+
+   double* trig = malloc(2*(half_n + 1)*sizeof(double));
+   if (trig == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   for (size_t k = 0; k <= half_n; k++) {
+      const double alpha = -2.0*M_PI*(double)k / (double)n;
+      trig[2*k]     = cos(alpha);
+      trig[2*k + 1] = sin(alpha);
+   }
+
+   wavetable->trig = create_table(handle, CL_MEM_READ_ONLY, trig, half_n + 1, &opencl_error);
+   free(trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   return wavetable;
+}
+
+void owl_fft_real_wavetable_free(owl_fft_real_wavetable* wavetable) {
+   cl_int opencl_error;
+
+   owl_fft_complex_wavetable_free(wavetable->complex);
+
+   opencl_error = clReleaseMemObject(wavetable->trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_VOID(NULL, opencl_error);
+
+   free(wavetable);
+}
+
+
+owl_fft_complex_wavetable_nd* owl_fft_complex_wavetable_nd_alloc(owl_fft_handle* handle, cl_uint rank, const size_t* n) {
+   if (rank == 0 || rank > OWL_FFT_MAX_RANK)
+      OWL_ERROR_NULL("unsupported rank", OWL_EINVAL);
+
+   owl_fft_complex_wavetable_nd* wavetable = calloc(sizeof(owl_fft_complex_wavetable_nd), 1);
+   if (wavetable == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   wavetable->rank = rank;
+   wavetable->size = 1;
+   for (cl_uint axis = 0; axis < rank; axis++) {
+      wavetable->n[axis] = n[axis];
+      wavetable->size *= n[axis];
+      wavetable->axes[axis] = owl_fft_complex_wavetable_alloc(handle, n[axis]);
+      if (wavetable->axes[axis] == NULL) {
+         wavetable->rank = axis;
+         owl_fft_complex_wavetable_nd_free(wavetable);
+         return NULL;
+      }
+   }
+
+   return wavetable;
+}
+
+void owl_fft_complex_wavetable_nd_free(owl_fft_complex_wavetable_nd* wavetable) {
+   for (cl_uint axis = 0; axis < wavetable->rank; axis++)
+      owl_fft_complex_wavetable_free(wavetable->axes[axis]);
+
+   free(wavetable);
+}
+
+
 owl_fft_complex_workspace* owl_fft_complex_workspace_alloc(owl_fft_handle* handle, size_t n) {
    cl_int opencl_error;
-   const size_t buffer_size = 2*n*sizeof(cl_float);
+   const size_t buffer_size = 2*n*handle->real_size;
 
    owl_fft_complex_workspace* workspace = calloc(sizeof(owl_fft_complex_workspace), 1);
    if (workspace == NULL)
@@ -71,6 +549,24 @@ owl_fft_complex_workspace* owl_fft_complex_workspace_alloc(owl_fft_handle* handl
    return workspace;
 }
 
+owl_fft_complex_workspace* owl_fft_complex_workspace_alloc_inplace(owl_fft_handle* handle, size_t n) {
+   cl_int opencl_error;
+   const size_t buffer_size = 2*n*handle->real_size;
+
+   owl_fft_complex_workspace* workspace = calloc(sizeof(owl_fft_complex_workspace), 1);
+   if (workspace == NULL)
+      OWL_ERROR_NULL("out of memory", OWL_NOMEM);
+
+   workspace->n = n;
+   workspace->buffers[0] = clCreateBuffer(handle->opencl->context, CL_MEM_READ_WRITE, buffer_size, NULL, &opencl_error);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR_NULL(NULL, opencl_error);
+
+   workspace->buffers[1] = NULL;
+
+   return workspace;
+}
+
 void owl_fft_complex_workspace_free(owl_fft_complex_workspace* workspace) {
    cl_int opencl_error;
 
@@ -78,61 +574,822 @@ void owl_fft_complex_workspace_free(owl_fft_complex_workspace* workspace) {
    if (opencl_error != CL_SUCCESS)
       OWL_ERROR_VOID(NULL, opencl_error);
 
-   opencl_error = clReleaseMemObject(workspace->buffers[1]);
-   if (opencl_error != CL_SUCCESS)
-      OWL_ERROR_VOID(NULL, opencl_error);
+   if (workspace->buffers[1] != NULL) {
+      opencl_error = clReleaseMemObject(workspace->buffers[1]);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR_VOID(NULL, opencl_error);
+   }
 
    free(workspace);
 }
 
 
-int owl_fft_complex_forward (owl_fft_handle* handle, float* data, size_t stride, size_t n,
+int owl_fft_complex_forward (owl_fft_handle* handle, void* data, size_t stride, size_t n,
                              const owl_fft_complex_wavetable* wavetable,
                              owl_fft_complex_workspace* workspace) {
-   cl_int opencl_error;
-   owl_opencl_handle* opencl = handle->opencl;
-   cl_uint param = 1;
-   unsigned int k = 0;
    if (n > workspace->n)
       return 1;
-   if (stride != 1)
-      return 2;
 
-   const size_t buffer_size = 2*n*sizeof(cl_float);
-   // Keep it simple for now, although MapBuffer etc. might sometimes be more optimal.
-   opencl_error = clEnqueueWriteBuffer(opencl->queues[0], workspace->buffers[0], CL_FALSE, 0, buffer_size,
-                                       data, 0, NULL, NULL);
-   if (opencl_error != CL_SUCCESS)
-      OWL_ERROR(NULL, opencl_error);
+   return transform_batch(handle, data, stride, n, 1, n, wavetable, workspace, OWL_FFT_FORWARD);
+}
 
-   size_t global_work_size = n >> 1;
-   // TODO fix this somehow!
-   size_t local_work_size  = global_work_size;
 
-   while (param < n) {
-      opencl_error = clSetKernelArg(handle->fft_kernel, 0, sizeof(cl_mem),  (void*)&workspace->buffers[k & 1]);
-      if (opencl_error != CL_SUCCESS)
-         OWL_ERROR(NULL, opencl_error);
-      opencl_error = clSetKernelArg(handle->fft_kernel, 1, sizeof(cl_mem),  (void*)&workspace->buffers[(k + 1) & 1]);
-      if (opencl_error != CL_SUCCESS)
-         OWL_ERROR(NULL, opencl_error);
-      opencl_error = clSetKernelArg(handle->fft_kernel, 2, sizeof(cl_uint), (void*)&param);
-      if (opencl_error != CL_SUCCESS)
-         OWL_ERROR(NULL, opencl_error);
+int owl_fft_complex_inverse (owl_fft_handle* handle, void* data, size_t stride, size_t n,
+                             const owl_fft_complex_wavetable* wavetable,
+                             owl_fft_complex_workspace* workspace) {
+   if (n > workspace->n)
+      return 1;
 
-      opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], handle->fft_kernel, 1, NULL,
-                                          &global_work_size, &local_work_size, 0, NULL, NULL);
-      if (opencl_error != CL_SUCCESS)
-         OWL_ERROR(NULL, opencl_error);
+   return transform_batch(handle, data, stride, n, 1, n, wavetable, workspace, OWL_FFT_BACKWARD);
+}
 
-      k += 1;
-      param = 1 << k;
+
+int owl_fft_complex_forward_batch (owl_fft_handle* handle, void* data, size_t n, size_t howmany, size_t dist,
+                                   const owl_fft_complex_wavetable* wavetable,
+                                   owl_fft_complex_workspace* workspace) {
+   return transform_batch(handle, data, 1, n, howmany, dist, wavetable, workspace, OWL_FFT_FORWARD);
+}
+
+
+int owl_fft_complex_inverse_batch (owl_fft_handle* handle, void* data, size_t n, size_t howmany, size_t dist,
+                                   const owl_fft_complex_wavetable* wavetable,
+                                   owl_fft_complex_workspace* workspace) {
+   return transform_batch(handle, data, 1, n, howmany, dist, wavetable, workspace, OWL_FFT_BACKWARD);
+}
+
+
+int owl_fft_complex_forward_enqueue (owl_fft_handle* handle, cl_mem input, cl_mem output, size_t n, size_t howmany,
+                                     const owl_fft_complex_wavetable* wavetable,
+                                     owl_fft_complex_workspace* workspace,
+                                     cl_uint num_events, const cl_event* wait_list, cl_event* event) {
+   return enqueue_device(handle, input, output, n, howmany, wavetable, workspace, OWL_FFT_FORWARD,
+                         num_events, wait_list, event);
+}
+
+
+int owl_fft_complex_inverse_enqueue (owl_fft_handle* handle, cl_mem input, cl_mem output, size_t n, size_t howmany,
+                                     const owl_fft_complex_wavetable* wavetable,
+                                     owl_fft_complex_workspace* workspace,
+                                     cl_uint num_events, const cl_event* wait_list, cl_event* event) {
+   return enqueue_device(handle, input, output, n, howmany, wavetable, workspace, OWL_FFT_BACKWARD,
+                         num_events, wait_list, event);
+}
+
+
+static int enqueue_device(owl_fft_handle* handle, cl_mem input, cl_mem output, size_t n, size_t howmany,
+                          const owl_fft_complex_wavetable* wavetable, owl_fft_complex_workspace* workspace,
+                          owl_fft_direction direction, cl_uint num_events, const cl_event* wait_list,
+                          cl_event* event) {
+   owl_fft_events events = {num_events, wait_list, event};
+
+   if (wavetable == NULL || wavetable->n != n)
+      OWL_ERROR("wavetable does not match the transform size", OWL_EINVAL);
+   if (wavetable->workspace_n*howmany > workspace->n)
+      OWL_ERROR("workspace too small for the batch", OWL_EINVAL);
+   if (input == workspace->buffers[0] || input == workspace->buffers[1] ||
+       output == workspace->buffers[0] || output == workspace->buffers[1])
+      OWL_ERROR("input and output must not be workspace buffers", OWL_EINVAL);
+
+   if (wavetable->bluestein != NULL) {
+      if (workspace->buffers[1] == NULL)
+         OWL_ERROR("Bluestein transforms need an out-of-place workspace", OWL_EINVAL);
+      return enqueue_bluestein(handle, wavetable, input, output, workspace->buffers, howmany, direction, &events);
    }
 
-   opencl_error = clEnqueueReadBuffer(opencl->queues[0], workspace->buffers[k & 1], CL_TRUE, 0, buffer_size,
+   return enqueue_passes(handle, wavetable, input, output, workspace->buffers, howmany, direction, &events);
+}
+
+
+// Transform howmany transforms of n points, element t of transform i being the complex
+// value i*dist + t*stride of data. The kernels always see a packed batch, and the host
+// never reorders the data: transforms with gaps between them are moved with rectangular
+// copies of one transform per row, and strided ones are copied whole to a staging buffer
+// and packed from it by the gather kernel, or with one point per row for large strides.
+static int transform_batch(owl_fft_handle* handle, void* data, size_t stride, size_t n, size_t howmany, size_t dist,
+                           const owl_fft_complex_wavetable* wavetable,
+                           owl_fft_complex_workspace* workspace, owl_fft_direction direction) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+   cl_uint result = 0;
+   cl_mem staging = NULL;
+
+   if (wavetable == NULL || wavetable->n != n)
+      OWL_ERROR("wavetable does not match the transform size", OWL_EINVAL);
+   if (stride == 0 || (howmany > 1 && dist < (n - 1)*stride + 1))
+      OWL_ERROR("transforms in the batch overlap", OWL_EINVAL);
+   if (wavetable->workspace_n*howmany > workspace->n)
+      OWL_ERROR("workspace too small for the batch", OWL_EINVAL);
+
+   const size_t point_size = 2*handle->real_size;
+   const size_t extent = (howmany - 1)*dist + (n - 1)*stride + 1;
+   const bool packed = stride == 1 && (dist == n || howmany == 1);
+   const bool gathered = stride > 1 && stride <= MAX_GATHER_STRIDE && extent <= UINT32_MAX;
+   const size_t origin[3] = {0, 0, 0};
+   const size_t region[3] = {stride == 1 ? n*point_size : point_size,
+                             stride == 1 ? howmany : n,
+                             stride == 1 ? 1 : howmany};
+   const size_t buffer_pitch[2] = {region[0], region[0]*region[1]};
+   const size_t host_pitch[2]   = {stride == 1 ? dist*point_size : stride*point_size,
+                                   stride == 1 || howmany == 1 ? 0 : dist*point_size};
+
+   if (packed)
+      opencl_error = clEnqueueWriteBuffer(opencl->queues[0], workspace->buffers[0], CL_FALSE, 0, howmany*n*point_size,
+                                          data, 0, NULL, NULL);
+   else if (gathered) {
+      staging = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE, extent*point_size, NULL, &opencl_error);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clEnqueueWriteBuffer(opencl->queues[0], staging, CL_FALSE, 0, extent*point_size,
+                                          data, 0, NULL, NULL);
+   } else
+      opencl_error = clEnqueueWriteBufferRect(opencl->queues[0], workspace->buffers[0], CL_FALSE, origin, origin,
+                                              region, buffer_pitch[0], buffer_pitch[1], host_pitch[0], host_pitch[1],
+                                              data, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   if (gathered) {
+      opencl_error = enqueue_strided(handle, handle->gather_kernel, staging, workspace->buffers[0], n, howmany,
+                                     stride, dist);
+      if (opencl_error != CL_SUCCESS)
+         return opencl_error;
+   }
+
+   opencl_error = enqueue_transform(handle, wavetable, workspace, howmany, direction, &result, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   if (gathered) {
+      opencl_error = enqueue_strided(handle, handle->scatter_kernel, workspace->buffers[result], staging, n, howmany,
+                                     stride, dist);
+      if (opencl_error != CL_SUCCESS)
+         return opencl_error;
+   }
+
+   if (packed)
+      opencl_error = clEnqueueReadBuffer(opencl->queues[0], workspace->buffers[result], CL_TRUE, 0, howmany*n*point_size,
+                                         data, 0, NULL, NULL);
+   else if (gathered)
+      opencl_error = clEnqueueReadBuffer(opencl->queues[0], staging, CL_TRUE, 0, extent*point_size,
+                                         data, 0, NULL, NULL);
+   else
+      opencl_error = clEnqueueReadBufferRect(opencl->queues[0], workspace->buffers[result], CL_TRUE, origin, origin,
+                                             region, buffer_pitch[0], buffer_pitch[1], host_pitch[0], host_pitch[1],
+                                             data, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   if (staging != NULL) {
+      opencl_error = clReleaseMemObject(staging);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+   }
+
+   return 0;
+}
+
+
+int owl_fft_complex_forward_nd (owl_fft_handle* handle, void* data,
+                                const owl_fft_complex_wavetable_nd* wavetable,
+                                owl_fft_complex_workspace* workspace) {
+   return transform_nd(handle, data, wavetable, workspace, OWL_FFT_FORWARD);
+}
+
+
+int owl_fft_complex_inverse_nd (owl_fft_handle* handle, void* data,
+                                const owl_fft_complex_wavetable_nd* wavetable,
+                                owl_fft_complex_workspace* workspace) {
+   return transform_nd(handle, data, wavetable, workspace, OWL_FFT_BACKWARD);
+}
+
+
+// Each axis is transformed while it is the contiguous one. A transpose of the
+// (size/n) x n matrix then rotates the axes by one, bringing the next axis last,
+// and after rank rotations the data is back in its original order.
+static int transform_nd(owl_fft_handle* handle, void* data, const owl_fft_complex_wavetable_nd* wavetable,
+                        owl_fft_complex_workspace* workspace, owl_fft_direction direction) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+   cl_uint buffer = 0;
+
+   if (workspace->buffers[1] == NULL)
+      OWL_ERROR("multidimensional transforms need an out-of-place workspace", OWL_EINVAL);
+   for (cl_uint axis = 0; axis < wavetable->rank; axis++)
+      if (wavetable->size / wavetable->n[axis] * wavetable->axes[axis]->workspace_n > workspace->n)
+         OWL_ERROR("workspace too small for the transform", OWL_EINVAL);
+
+   const size_t buffer_size = 2*wavetable->size*handle->real_size;
+   opencl_error = clEnqueueWriteBuffer(opencl->queues[0], workspace->buffers[0], CL_FALSE, 0, buffer_size,
+                                       data, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   for (cl_uint axis = wavetable->rank; axis-- > 0; ) {
+      const size_t n = wavetable->n[axis];
+      const size_t rows = wavetable->size / n;
+
+      opencl_error = enqueue_transform(handle, wavetable->axes[axis], workspace, rows, direction, &buffer, NULL);
+      if (opencl_error != CL_SUCCESS)
+         return opencl_error;
+
+      if (rows > 1) {
+         opencl_error = enqueue_transpose(handle, workspace->buffers[buffer], workspace->buffers[1 - buffer], rows, n);
+         if (opencl_error != CL_SUCCESS)
+            return opencl_error;
+         buffer = 1 - buffer;
+      }
+   }
+
+   opencl_error = clEnqueueReadBuffer(opencl->queues[0], workspace->buffers[buffer], CL_TRUE, 0, buffer_size,
+                                      data, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+int owl_fft_real_forward (owl_fft_handle* handle, const void* data, void* spectrum, size_t n,
+                          const owl_fft_real_wavetable* wavetable,
+                          owl_fft_complex_workspace* workspace) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+   cl_uint result = 0;
+   const cl_uint half_n = n/2;
+   const size_t global_work_size = half_n/2 + 1;
+
+   if (wavetable == NULL || wavetable->n != n)
+      OWL_ERROR("wavetable does not match the transform size", OWL_EINVAL);
+   if (half_n + 1 > workspace->n || wavetable->complex->workspace_n > workspace->n)
+      OWL_ERROR("workspace too small for the transform", OWL_EINVAL);
+
+   // The real data is already packed as n/2 complex values z[t] = x[2t] + i x[2t + 1]
+   opencl_error = clEnqueueWriteBuffer(opencl->queues[0], workspace->buffers[0], CL_FALSE, 0, n*handle->real_size,
                                        data, 0, NULL, NULL);
    if (opencl_error != CL_SUCCESS)
       OWL_ERROR(NULL, opencl_error);
 
+   opencl_error = enqueue_transform(handle, wavetable->complex, workspace, 1, OWL_FFT_FORWARD, &result, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   opencl_error = clSetKernelArg(handle->r2c_kernel, 0, sizeof(cl_mem), (void*)&workspace->buffers[result]);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->r2c_kernel, 1, sizeof(cl_mem), (void*)&wavetable->trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->r2c_kernel, 2, sizeof(cl_uint), (void*)&half_n);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], handle->r2c_kernel, 1, NULL,
+                                         &global_work_size, NULL, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clEnqueueReadBuffer(opencl->queues[0], workspace->buffers[result], CL_TRUE, 0,
+                                      2*(half_n + 1)*handle->real_size, spectrum, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
    return 0;
 }
+
+
+int owl_fft_real_inverse (owl_fft_handle* handle, const void* spectrum, void* data, size_t n,
+                          const owl_fft_real_wavetable* wavetable,
+                          owl_fft_complex_workspace* workspace) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+   cl_uint result = 0;
+   const cl_uint half_n = n/2;
+   const size_t global_work_size = half_n/2 + 1;
+
+   if (wavetable == NULL || wavetable->n != n)
+      OWL_ERROR("wavetable does not match the transform size", OWL_EINVAL);
+   if (half_n + 1 > workspace->n || wavetable->complex->workspace_n > workspace->n)
+      OWL_ERROR("workspace too small for the transform", OWL_EINVAL);
+
+   opencl_error = clEnqueueWriteBuffer(opencl->queues[0], workspace->buffers[0], CL_FALSE, 0,
+                                       2*(half_n + 1)*handle->real_size, spectrum, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clSetKernelArg(handle->c2r_kernel, 0, sizeof(cl_mem), (void*)&workspace->buffers[0]);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->c2r_kernel, 1, sizeof(cl_mem), (void*)&wavetable->trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->c2r_kernel, 2, sizeof(cl_uint), (void*)&half_n);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], handle->c2r_kernel, 1, NULL,
+                                         &global_work_size, NULL, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_transform(handle, wavetable->complex, workspace, 1, OWL_FFT_BACKWARD, &result, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   opencl_error = clEnqueueReadBuffer(opencl->queues[0], workspace->buffers[result], CL_TRUE, 0, n*handle->real_size,
+                                      data, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+// Enqueue all passes for howmany transforms stored back to back in the workspace buffer
+// with index *buffer. On return *buffer is the index of the buffer holding the transformed data.
+// events may be NULL.
+static int enqueue_transform(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                             owl_fft_complex_workspace* workspace, size_t howmany,
+                             owl_fft_direction direction, cl_uint* buffer, owl_fft_events* events) {
+   owl_fft_events no_events = {0, NULL, NULL};
+   if (events == NULL)
+      events = &no_events;
+
+   const cl_uint input = *buffer;
+   const cl_mem scratch[2] = {workspace->buffers[1 - input], workspace->buffers[input]};
+
+   if (wavetable->bluestein != NULL) {
+      if (workspace->buffers[1] == NULL)
+         OWL_ERROR("Bluestein transforms need an out-of-place workspace", OWL_EINVAL);
+      return enqueue_bluestein(handle, wavetable, scratch[1], scratch[1], scratch, howmany, direction, events);
+   }
+
+   if (workspace->buffers[1] == NULL) {
+      *buffer = 0;
+      return enqueue_passes(handle, wavetable, workspace->buffers[0], workspace->buffers[0], workspace->buffers,
+                            howmany, direction, events);
+   }
+
+   // The passes alternate between the two buffers, starting from *buffer
+   *buffer = (input + wavetable->nf + 1) & 1;
+
+   return enqueue_passes(handle, wavetable, workspace->buffers[input], workspace->buffers[*buffer], scratch,
+                         howmany, direction, events);
+}
+
+
+// Bluestein transform from input to output, through the m-point transforms in scratch.
+// The chirped input starts in scratch[0]. Each transform moves the data to the other
+// buffer if it has an even number of global passes, so the first one may end in either
+// buffer, but the second one starts where the first ended with the same passes, and the
+// product is back in scratch[0]. input is only read before the first pass and output
+// only written after the last one, so either may be scratch[1].
+static int enqueue_bluestein(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                             cl_mem input, cl_mem output, const cl_mem* scratch, size_t howmany,
+                             owl_fft_direction direction, owl_fft_events* events) {
+   cl_int opencl_error;
+   const cl_uint n = wavetable->n;
+   const cl_uint m = wavetable->workspace_n;
+   owl_fft_complex_workspace padded = {m*howmany, {scratch[0], scratch[1]}};
+   cl_uint buffer = 0;
+   cl_double2 pre = {{1.0, 1.0}}, post = {{1.0, 1.0}};
+
+   if (direction == OWL_FFT_BACKWARD) {
+      pre.s[1]  = -1.0;
+      post.s[0] =  1.0 / n;
+      post.s[1] = -1.0 / n;
+   }
+
+   size_t global_work_size[2] = {m, howmany};
+
+   opencl_error = clSetKernelArg(handle->bluestein_pre_kernel, 0, sizeof(cl_mem), (void*)&input);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_pre_kernel, 1, sizeof(cl_mem), (void*)&padded.buffers[0]);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_pre_kernel, 2, sizeof(cl_mem), (void*)&wavetable->chirp);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_pre_kernel, 3, sizeof(cl_uint), (void*)&n);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_pre_kernel, 4, sizeof(cl_uint), (void*)&m);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = set_complex_arg(handle, handle->bluestein_pre_kernel, 5, pre);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, handle->bluestein_pre_kernel, global_work_size, NULL, events, false);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_transform(handle, wavetable->bluestein, &padded, howmany, OWL_FFT_FORWARD, &buffer, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+
+   opencl_error = clSetKernelArg(handle->bluestein_multiply_kernel, 0, sizeof(cl_mem), (void*)&padded.buffers[buffer]);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_multiply_kernel, 1, sizeof(cl_mem), (void*)&wavetable->filter);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_multiply_kernel, 2, sizeof(cl_uint), (void*)&m);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, handle->bluestein_multiply_kernel, global_work_size, NULL, NULL, false);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_transform(handle, wavetable->bluestein, &padded, howmany, OWL_FFT_FORWARD, &buffer, NULL);
+   if (opencl_error != CL_SUCCESS)
+      return opencl_error;
+   assert(buffer == 0);
+
+   global_work_size[0] = n;
+
+   opencl_error = clSetKernelArg(handle->bluestein_post_kernel, 0, sizeof(cl_mem), (void*)&padded.buffers[buffer]);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_post_kernel, 1, sizeof(cl_mem), (void*)&output);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_post_kernel, 2, sizeof(cl_mem), (void*)&wavetable->chirp);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_post_kernel, 3, sizeof(cl_uint), (void*)&n);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bluestein_post_kernel, 4, sizeof(cl_uint), (void*)&m);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = set_complex_arg(handle, handle->bluestein_post_kernel, 5, post);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, handle->bluestein_post_kernel, global_work_size, NULL, events, true);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+// Enqueue all passes from input to output. The passes in between alternate between
+// scratch[0] and scratch[1], so input is only read by the first pass and output can be
+// the same buffer. If scratch[1] is NULL the transform is done in place in output.
+// The inverse transform is computed as conj(forward(conj(x)))/n, with the conjugations
+// and the scaling done by the first and the last pass.
+static int enqueue_passes(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                          cl_mem input, cl_mem output, const cl_mem* scratch, size_t howmany,
+                          owl_fft_direction direction, owl_fft_events* events) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+   const size_t n = wavetable->n;
+   const cl_double2 one = {{1.0, 1.0}};
+   cl_double2 pre = one, post = one;
+   cl_uint p = 1;
+   cl_mem in = input;
+
+   if (direction == OWL_FFT_BACKWARD) {
+      pre.s[1]  = -1.0;
+      post.s[0] =  1.0 / n;
+      post.s[1] = -1.0 / n;
+   }
+
+   if (scratch[1] == NULL) {
+      if (input != output) {
+         opencl_error = clEnqueueCopyBuffer(opencl->queues[0], input, output, 0, 0, 2*howmany*n*handle->real_size,
+                                            events->num_events, events->wait_list, NULL);
+         if (opencl_error != CL_SUCCESS)
+            OWL_ERROR(NULL, opencl_error);
+         events->num_events = 0;
+         events->wait_list = NULL;
+      }
+      return enqueue_inplace(handle, wavetable, output, howmany, pre, post, events);
+   }
+
+   for (cl_uint f = 0; f < wavetable->nf; f++) {
+      const cl_uint radix = wavetable->factor[f];
+      cl_kernel kernel = radix_kernel(handle, radix);
+      size_t global_work_size[2] = {n / radix, howmany};
+
+      cl_mem out = scratch[f & 1];
+
+      opencl_error = clSetKernelArg(kernel, 0, sizeof(cl_mem),  (void*)&in);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(kernel, 1, sizeof(cl_mem),  (void*)&out);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(kernel, 2, sizeof(cl_mem),  (void*)&wavetable->twiddle);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(kernel, 3, sizeof(cl_uint), (void*)&p);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(kernel, 4, sizeof(cl_uint), (void*)&wavetable->local_n);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = set_complex_arg(handle, kernel, 5, pre);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = set_complex_arg(handle, kernel, 6, one);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+
+      opencl_error = enqueue_kernel(handle, kernel, global_work_size, NULL, events, false);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+
+      pre = one;
+      in = out;
+      p *= radix;
+   }
+
+   // Finish in local memory, one work-group per transform of length local_n
+   size_t local_size[2] = {local_work_size(handle, wavetable->local_n), 1};
+   size_t global_work_size[2] = {(n / wavetable->local_n)*local_size[0], howmany};
+
+   opencl_error = clSetKernelArg(handle->local_kernel, 0, sizeof(cl_mem), (void*)&in);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_kernel, 1, sizeof(cl_mem), (void*)&output);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_kernel, 2, sizeof(cl_mem), (void*)&wavetable->trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_kernel, 3, 4*wavetable->local_n*handle->real_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_kernel, 4, sizeof(cl_uint), (void*)&wavetable->local_n);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = set_complex_arg(handle, handle->local_kernel, 5, pre);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = set_complex_arg(handle, handle->local_kernel, 6, post);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, handle->local_kernel, global_work_size, local_size, events, true);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+// In-place version of enqueue_transform. If the transform fits in local memory, the local
+// memory kernel can work in place. Otherwise the data is bit reversed, the first stages are
+// done in local memory and the rest with in-place decimation in time passes.
+static int enqueue_inplace(owl_fft_handle* handle, const owl_fft_complex_wavetable* wavetable,
+                           cl_mem buffer, size_t howmany, cl_double2 pre, cl_double2 post,
+                           owl_fft_events* events) {
+   cl_int opencl_error;
+   const size_t n = wavetable->n;
+   const cl_double2 one = {{1.0, 1.0}};
+   size_t local_size[2] = {local_work_size(handle, wavetable->local_n), 1};
+   size_t global_work_size[2] = {(n / wavetable->local_n)*local_size[0], howmany};
+
+   if (wavetable->nf == 0) {
+      opencl_error = clSetKernelArg(handle->local_kernel, 0, sizeof(cl_mem), (void*)&buffer);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->local_kernel, 1, sizeof(cl_mem), (void*)&buffer);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->local_kernel, 2, sizeof(cl_mem), (void*)&wavetable->trig);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->local_kernel, 3, 4*wavetable->local_n*handle->real_size, NULL);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->local_kernel, 4, sizeof(cl_uint), (void*)&wavetable->local_n);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = set_complex_arg(handle, handle->local_kernel, 5, pre);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = set_complex_arg(handle, handle->local_kernel, 6, post);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+
+      opencl_error = enqueue_kernel(handle, handle->local_kernel, global_work_size, local_size, events, true);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+
+      return 0;
+   }
+
+   cl_uint bits = 0;
+   while (((size_t)1 << bits) < n)
+      bits++;
+   size_t bitreverse_size[2] = {n, howmany};
+
+   opencl_error = clSetKernelArg(handle->bitreverse_kernel, 0, sizeof(cl_mem), (void*)&buffer);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->bitreverse_kernel, 1, sizeof(cl_uint), (void*)&bits);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, handle->bitreverse_kernel, bitreverse_size, NULL, events, false);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clSetKernelArg(handle->local_inplace_kernel, 0, sizeof(cl_mem), (void*)&buffer);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_inplace_kernel, 1, sizeof(cl_mem), (void*)&wavetable->trig);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_inplace_kernel, 2, 4*wavetable->local_n*handle->real_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->local_inplace_kernel, 3, sizeof(cl_uint), (void*)&wavetable->local_n);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = set_complex_arg(handle, handle->local_inplace_kernel, 4, pre);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = set_complex_arg(handle, handle->local_inplace_kernel, 5, one);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, handle->local_inplace_kernel, global_work_size, local_size, events, false);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   cl_uint p = wavetable->local_n;
+   for (cl_uint f = 0; f < wavetable->nf; f++) {
+      cl_uint radix = wavetable->factor[f];
+      size_t pass_size[2] = {n / radix, howmany};
+      const cl_double2 pass_post = f + 1 == wavetable->nf ? post : one;
+
+      opencl_error = clSetKernelArg(handle->inplace_kernel, 0, sizeof(cl_mem), (void*)&buffer);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->inplace_kernel, 1, sizeof(cl_mem), (void*)&wavetable->trig);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->inplace_kernel, 2, sizeof(cl_uint), (void*)&p);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = clSetKernelArg(handle->inplace_kernel, 3, sizeof(cl_uint), (void*)&radix);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+      opencl_error = set_complex_arg(handle, handle->inplace_kernel, 4, pass_post);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+
+      opencl_error = enqueue_kernel(handle, handle->inplace_kernel, pass_size, NULL, events,
+                                    f + 1 == wavetable->nf);
+      if (opencl_error != CL_SUCCESS)
+         OWL_ERROR(NULL, opencl_error);
+
+      p *= radix;
+   }
+
+   return 0;
+}
+
+
+static int enqueue_transpose(owl_fft_handle* handle, cl_mem data, cl_mem output, size_t rows, size_t cols) {
+   cl_int opencl_error;
+   owl_opencl_handle* opencl = handle->opencl;
+   const size_t tile = handle->tile_size;
+   const size_t local_work_size[2]  = {tile, tile};
+   const size_t global_work_size[2] = {(cols + tile - 1)/tile*tile, (rows + tile - 1)/tile*tile};
+   const cl_uint rows_arg = rows, cols_arg = cols;
+
+   opencl_error = clSetKernelArg(handle->transpose_kernel, 0, sizeof(cl_mem), (void*)&data);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->transpose_kernel, 1, sizeof(cl_mem), (void*)&output);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->transpose_kernel, 2, 2*tile*(tile + 1)*handle->real_size, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->transpose_kernel, 3, sizeof(cl_uint), (void*)&rows_arg);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(handle->transpose_kernel, 4, sizeof(cl_uint), (void*)&cols_arg);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = clEnqueueNDRangeKernel(opencl->queues[0], handle->transpose_kernel, 2, NULL,
+                                         global_work_size, local_work_size, 0, NULL, NULL);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+// Gather or scatter the strided points of a batch between data and output, see owl_fft_gather.
+static int enqueue_strided(owl_fft_handle* handle, cl_kernel kernel, cl_mem data, cl_mem output, size_t n,
+                           size_t howmany, size_t stride, size_t dist) {
+   cl_int opencl_error;
+   const size_t global_work_size[2] = {n, howmany};
+   const cl_uint n_arg = n, stride_arg = stride, dist_arg = dist;
+
+   opencl_error = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&data);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&output);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(kernel, 2, sizeof(cl_uint), (void*)&n_arg);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(kernel, 3, sizeof(cl_uint), (void*)&stride_arg);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+   opencl_error = clSetKernelArg(kernel, 4, sizeof(cl_uint), (void*)&dist_arg);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   opencl_error = enqueue_kernel(handle, kernel, global_work_size, NULL, NULL, false);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   return 0;
+}
+
+
+static cl_int enqueue_kernel(owl_fft_handle* handle, cl_kernel kernel, const size_t* global_work_size,
+                             const size_t* local_work_size, owl_fft_events* events, bool last) {
+   cl_int opencl_error;
+
+   if (events == NULL)
+      return clEnqueueNDRangeKernel(handle->opencl->queues[0], kernel, 2, NULL, global_work_size,
+                                    local_work_size, 0, NULL, NULL);
+
+   opencl_error = clEnqueueNDRangeKernel(handle->opencl->queues[0], kernel, 2, NULL, global_work_size,
+                                         local_work_size, events->num_events, events->wait_list,
+                                         last ? events->event : NULL);
+   events->num_events = 0;
+   events->wait_list = NULL;
+
+   return opencl_error;
+}
+
+
+// Tables are computed in double precision and stored in the precision of the kernels.
+static cl_mem create_table(owl_fft_handle* handle, cl_mem_flags flags, const double* values, size_t n,
+                           cl_int* opencl_error) {
+   cl_mem table;
+
+   if (handle->precision == OWL_FFT_DOUBLE)
+      return clCreateBuffer(handle->opencl->context, flags|CL_MEM_COPY_HOST_PTR, 2*n*sizeof(cl_double),
+                            (void*)values, opencl_error);
+
+   cl_float* single = malloc(2*n*sizeof(cl_float));
+   if (single == NULL) {
+      *opencl_error = CL_OUT_OF_HOST_MEMORY;
+      return NULL;
+   }
+   for (size_t i = 0; i < 2*n; i++)
+      single[i] = values[i];
+
+   table = clCreateBuffer(handle->opencl->context, flags|CL_MEM_COPY_HOST_PTR, 2*n*sizeof(cl_float),
+                          single, opencl_error);
+   free(single);
+   return table;
+}
+
+
+static cl_int set_complex_arg(owl_fft_handle* handle, cl_kernel kernel, cl_uint index, cl_double2 value) {
+   if (handle->precision == OWL_FFT_DOUBLE)
+      return clSetKernelArg(kernel, index, sizeof(cl_double2), (void*)&value);
+
+   const cl_float2 single = {{value.s[0], value.s[1]}};
+   return clSetKernelArg(kernel, index, sizeof(cl_float2), (void*)&single);
+}
+
+
+// Work-group size for the local memory kernels
+static size_t local_work_size(owl_fft_handle* handle, size_t local_n) {
+   size_t size = local_n / 8;
+   if (size > handle->local_work_size)
+      size = handle->local_work_size;
+   if (size == 0)
+      size = 1;
+   return size;
+}
+
+
+static cl_kernel radix_kernel(owl_fft_handle* handle, cl_uint radix) {
+   switch (radix) {
+      case 2:
+         return handle->radix2_kernel;
+      case 4:
+         return handle->radix4_kernel;
+      default:
+         return handle->radix8_kernel;
+   }
+}
@@ -1,37 +1,421 @@
-// This version is adapted from www.bealto.com
-// Parameter p is the length of sub-FFT
-#define PI 3.14159265359f
-#define  DFT2(a, b) { float2 tmp = a - b; a = a + b; b = tmp; }
+// Stockham autosort passes, originally adapted from www.bealto.com
+// and extended to radix 4 and 8.
+// Parameter p is the length of sub-FFT. The twiddle factors w_{pr}^(jk), j = 1..r-1, k < p,
+// of a radix r pass start at twiddle[p - 1].
+// The global passes run v interleaved transforms at once: element t of transform s
+// is at index t*v + s. For a plain 1D transform v = 1.
+// Batches of transforms are stored back to back, the second NDRange dimension
+// picks the transform.
+// All kernels only compute forward transforms. The input is multiplied elementwise
+// with pre and the output with post, which gives the conjugations and the scaling
+// of the inverse transform without extra passes.
+// The same source is built in single precision, or in double precision when
+// OWL_FFT_DOUBLE is defined.
+#ifdef OWL_FFT_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double  real;
+typedef double2 real2;
+#define M_SQRT1_2R 0.70710678118654752440
+#else
+typedef float  real;
+typedef float2 real2;
+#define M_SQRT1_2R 0.70710678118654752440f
+#endif
 
-float2 mul(float2 a, float2 b) {
-   return (float2)(a.x*b.x - a.y*b.y, a.x*b.y + a.y*b.x);
+#define  DFT2(a, b) { real2 tmp = a - b; a = a + b; b = tmp; }
+
+real2 mul(real2 a, real2 b) {
+   return (real2)(a.x*b.x - a.y*b.y, a.x*b.y + a.y*b.x);
+}
+
+// Multiplication by -i
+real2 mul_mi(real2 a) {
+   return (real2)(a.y, -a.x);
 }
 
+uint bit_reverse(uint x, uint bits) {
+   uint y = 0;
+   for (uint i = 0; i < bits; i++) {
+      y = (y << 1) | (x & 1);
+      x >>= 1;
+   }
+   return y;
+}
 
-float2 twiddle(float2 x, int k, float alpha) {
-   float s, c;
-   s = sincos((float)k*alpha, &c);
-   return mul(x, (float2)(c, s));
+// In-place 4-point DFT, output in natural order
+void dft4(real2* a0, real2* a1, real2* a2, real2* a3) {
+   DFT2(*a0, *a2);
+   DFT2(*a1, *a3);
+   *a3 = mul_mi(*a3);
+   DFT2(*a0, *a1);
+   DFT2(*a2, *a3);
+   // Now a0 = X0, a1 = X2, a2 = X1, a3 = X3
+   real2 tmp = *a1;
+   *a1 = *a2;
+   *a2 = tmp;
 }
 
+// In-place 8-point DFT, output in natural order
+void dft8(real2* u) {
+   dft4(&u[0], &u[2], &u[4], &u[6]);
+   dft4(&u[1], &u[3], &u[5], &u[7]);
 
-__kernel void owl_fft_radix2(__global const float2* data, __global float2* output, unsigned int p) {
-   const uint thread_id = get_global_id(0);
+   u[3] = M_SQRT1_2R*(real2)(u[3].x + u[3].y, u[3].y - u[3].x);
+   u[5] = mul_mi(u[5]);
+   u[7] = M_SQRT1_2R*(real2)(u[7].y - u[7].x, -u[7].x - u[7].y);
+
+   real2 e[4] = {u[0], u[2], u[4], u[6]};
+   real2 o[4] = {u[1], u[3], u[5], u[7]};
+   for (int j = 0; j < 4; j++) {
+      u[j]     = e[j] + o[j];
+      u[j + 4] = e[j] - o[j];
+   }
+}
+
+// r-point DFT for the kernels that pick the radix at run time
+void dft(real2* u, uint r) {
+   if (r == 8)
+      dft8(u);
+   else if (r == 4)
+      dft4(&u[0], &u[1], &u[2], &u[3]);
+   else
+      DFT2(u[0], u[1]);
+}
 
-   const uint T = get_global_size(0);  // Number of threads
-   const uint N = 2*T;                 // Amount of (complex) data points
-   const uint k = thread_id & (p - 1);   // index only for powers of 2
-   const uint j = ((thread_id - k) << 1) + k;    // output index (TODO why?!)
 
-   float2 u0 = data[thread_id];
-   float2 u1 = data[thread_id + T];
+__kernel void owl_fft_radix2(__global const real2* data, __global real2* output,
+                             __global const real2* twiddle, unsigned int p, unsigned int v,
+                             real2 pre, real2 post) {
+   const uint thread_id = get_global_id(0);
+   twiddle += p - 1;
+
+   const uint T  = get_global_size(0);        // Number of threads
+   const uint kv = thread_id & (p*v - 1);     // index only for powers of 2
+   const uint k  = kv / v;
+   const uint j  = ((thread_id - kv) << 1) + kv;
+   data   += (T << 1)*get_global_id(1);
+   output += (T << 1)*get_global_id(1);
 
-   float alpha = -PI*(float)k / (float)p;
+   real2 u0 = pre*data[thread_id];
+   real2 u1 = pre*data[thread_id + T];
 
-   u1 = twiddle(u1, 1, alpha);
+   u1 = mul(u1, twiddle[k]);
 
    DFT2(u0, u1);
 
-   output[j] = u0;
-   output[j + p] = u1;
+   output[j] = post*u0;
+   output[j + p*v] = post*u1;
+}
+
+
+__kernel void owl_fft_radix4(__global const real2* data, __global real2* output,
+                             __global const real2* twiddle, unsigned int p, unsigned int v,
+                             real2 pre, real2 post) {
+   const uint thread_id = get_global_id(0);
+   twiddle += p - 1;
+
+   const uint T  = get_global_size(0);
+   const uint kv = thread_id & (p*v - 1);
+   const uint k  = kv / v;
+   const uint j  = ((thread_id - kv) << 2) + kv;
+   data   += (T << 2)*get_global_id(1);
+   output += (T << 2)*get_global_id(1);
+
+   real2 u0 = pre*data[thread_id];
+   real2 u1 = mul(pre*data[thread_id +   T], twiddle[k]);
+   real2 u2 = mul(pre*data[thread_id + 2*T], twiddle[k + p]);
+   real2 u3 = mul(pre*data[thread_id + 3*T], twiddle[k + 2*p]);
+
+   dft4(&u0, &u1, &u2, &u3);
+
+   output[j]         = post*u0;
+   output[j +   p*v] = post*u1;
+   output[j + 2*p*v] = post*u2;
+   output[j + 3*p*v] = post*u3;
+}
+
+
+__kernel void owl_fft_radix8(__global const real2* data, __global real2* output,
+                             __global const real2* twiddle, unsigned int p, unsigned int v,
+                             real2 pre, real2 post) {
+   const uint thread_id = get_global_id(0);
+   twiddle += p - 1;
+
+   const uint T  = get_global_size(0);
+   const uint kv = thread_id & (p*v - 1);
+   const uint k  = kv / v;
+   const uint j  = ((thread_id - kv) << 3) + kv;
+   data   += (T << 3)*get_global_id(1);
+   output += (T << 3)*get_global_id(1);
+   real2 u[8];
+
+   u[0] = pre*data[thread_id];
+   for (int m = 1; m < 8; m++)
+      u[m] = mul(pre*data[thread_id + m*T], twiddle[k + (m - 1)*p]);
+
+   dft8(u);
+
+   for (int m = 0; m < 8; m++)
+      output[j + m*p*v] = post*u[m];
+}
+
+
+// Stockham stages of an m-point FFT in local memory, ping-ponging between in and out.
+// Returns the buffer that holds the result. trig holds the n-th roots of unity w_n^i, i < n,
+// where n = m times the number of work-groups.
+__local real2* local_stages(__local real2* in, __local real2* out,
+                             __global const real2* trig, uint m) {
+   const uint thread_id = get_local_id(0);
+   const uint wg_size   = get_local_size(0);
+   const uint nb = get_num_groups(0);
+   __local real2* tmp;
+   real2 u[8];
+
+   // Same factorization as for the global passes: radix 8 first, then 4 or 2
+   for (uint p = 1; p < m; ) {
+      uint r = 8;
+      while ((m/p) % r != 0)
+         r >>= 1;
+      const uint T = m / r;
+      // w_{pr}^(jk) = w_n^(jk*stride)
+      const uint stride = nb*T/p;
+
+      for (uint i = thread_id; i < T; i += wg_size) {
+         const uint k = i & (p - 1);
+         const uint j = (i - k)*r + k;
+
+         u[0] = in[i];
+         for (uint q = 1; q < r; q++)
+            u[q] = mul(in[i + q*T], trig[q*k*stride]);
+
+         dft(u, r);
+
+         for (uint q = 0; q < r; q++)
+            out[j + q*p] = u[q];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      tmp = in;
+      in  = out;
+      out = tmp;
+      p *= r;
+   }
+
+   return in;
+}
+
+
+// Complete FFT of m points in local memory, one work-group per transform.
+// With n > m this finishes a transform whose n/m global passes are already done:
+// group b applies the twiddles w_n^(bt) to its contiguous block of m points, transforms
+// it and writes the result with stride n/m.
+// The buffer must have room for 2*m points. With n = m data and output may be the same buffer.
+__kernel void owl_fft_local(__global const real2* data, __global real2* output,
+                            __global const real2* trig, __local real2* buffer, unsigned int m,
+                            real2 pre, real2 post) {
+   const uint thread_id = get_local_id(0);
+   const uint wg_size   = get_local_size(0);
+   const uint b  = get_group_id(0);
+   const uint nb = get_num_groups(0);
+   __local real2* in = buffer;
+
+   data   += (get_group_id(1)*nb + b)*m;
+   output += get_group_id(1)*nb*m;
+   for (uint t = thread_id; t < m; t += wg_size)
+      in[t] = mul(pre*data[t], trig[b*t]);
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   in = local_stages(in, buffer + m, trig, m);
+
+   for (uint t = thread_id; t < m; t += wg_size)
+      output[b + nb*t] = post*in[t];
+}
+
+
+// In-place transforms larger than local memory are done with decimation in time:
+// the data is first permuted to bit reversed order, and the passes then read and
+// write the same elements, so no second buffer is needed.
+__kernel void owl_fft_bitreverse(__global real2* data, unsigned int bits) {
+   const uint i = get_global_id(0);
+   const uint j = bit_reverse(i, bits);
+
+   data += get_global_size(0)*get_global_id(1);
+   if (i < j) {
+      real2 tmp = data[i];
+      data[i] = data[j];
+      data[j] = tmp;
+   }
+}
+
+
+// First stages of an in-place transform: after the bit reversal each contiguous
+// block of m points is an m-point transform in bit reversed order.
+__kernel void owl_fft_local_inplace(__global real2* data, __global const real2* trig,
+                                    __local real2* buffer, unsigned int m, real2 pre, real2 post) {
+   const uint thread_id = get_local_id(0);
+   const uint wg_size   = get_local_size(0);
+   const uint nb   = get_num_groups(0);
+   const uint bits = 31 - clz(m);
+   __local real2* in = buffer;
+
+   data += (get_group_id(1)*nb + get_group_id(0))*m;
+   for (uint t = thread_id; t < m; t += wg_size)
+      in[bit_reverse(t, bits)] = pre*data[t];
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   in = local_stages(in, buffer + m, trig, m);
+
+   for (uint t = thread_id; t < m; t += wg_size)
+      data[t] = post*in[t];
+}
+
+
+// In-place radix r pass combining r consecutive transforms of length p.
+// Because of the bit reversed order, input q of the butterfly comes from
+// the transform bit_reverse(q).
+__kernel void owl_fft_inplace(__global real2* data, __global const real2* trig,
+                              unsigned int p, unsigned int r, real2 post) {
+   const uint thread_id = get_global_id(0);
+   const uint T    = get_global_size(0);
+   const uint k    = thread_id & (p - 1);
+   const uint j    = (thread_id - k)*r + k;
+   const uint bits = 31 - clz(r);
+   // w_{pr}^(qk) = w_n^(qk*stride)
+   const uint stride = T/p;
+   real2 u[8];
+
+   data += T*r*get_global_id(1);
+   u[0] = data[j];
+   for (uint q = 1; q < r; q++)
+      u[q] = mul(data[j + bit_reverse(q, bits)*p], trig[q*k*stride]);
+
+   dft(u, r);
+
+   for (uint q = 0; q < r; q++)
+      data[j + q*p] = post*u[q];
+}
+
+
+// Real transforms of n = 2N points are done as N-point complex transforms of
+// z[t] = x[2t] + i x[2t + 1]. The spectrum of x is recovered from Z by
+// X[k] = (Z[k] + conj(Z[N - k]))/2 - i w_n^k (Z[k] - conj(Z[N - k]))/2, k = 0..N.
+// Thread k handles the pair k, N - k, so the pass can be done in place in a buffer of N + 1
+// points. trig holds w_n^k, k <= N.
+__kernel void owl_fft_r2c_post(__global real2* data, __global const real2* trig, unsigned int N) {
+   const uint k = get_global_id(0);
+   const uint l = N - k;
+
+   const real2 a = data[k];
+   const real2 b = data[l % N];
+   const real2 conj_a = (real2)(a.x, -a.y);
+   const real2 conj_b = (real2)(b.x, -b.y);
+
+   data[k] = (real)0.5f*(a + conj_b + mul(trig[k], mul_mi(a - conj_b)));
+   data[l] = (real)0.5f*(b + conj_a + mul(trig[l], mul_mi(b - conj_a)));
+}
+
+
+// Inverse of owl_fft_r2c_post: Z[k] = (X[k] + conj(X[N - k]))/2 + i conj(w_n^k) (X[k] - conj(X[N - k]))/2,
+// after which the inverse complex transform of Z gives x packed as above.
+__kernel void owl_fft_c2r_pre(__global real2* data, __global const real2* trig, unsigned int N) {
+   const uint k = get_global_id(0);
+   const uint l = N - k;
+
+   const real2 a = data[k];
+   const real2 b = data[l];
+   const real2 conj_a = (real2)(a.x, -a.y);
+   const real2 conj_b = (real2)(b.x, -b.y);
+   const real2 wk = (real2)(trig[k].x, -trig[k].y);
+   const real2 wl = (real2)(trig[l].x, -trig[l].y);
+
+   // Multiplication by i is -mul_mi
+   data[k] = (real)0.5f*(a + conj_b - mul_mi(mul(wk, a - conj_b)));
+   if (k > 0)
+      data[l] = (real)0.5f*(b + conj_a - mul_mi(mul(wl, b - conj_a)));
+}
+
+
+// Transpose a rows x cols matrix through a square tile in local memory, so that both
+// the reads and the writes are coalesced. The work-group is tile_size x tile_size,
+// and the tile has tile_size*(tile_size + 1) points: the extra column keeps the
+// column-wise accesses free of bank conflicts.
+// Multidimensional transforms use this to bring each axis in turn to the contiguous position.
+__kernel void owl_fft_transpose(__global const real2* data, __global real2* output,
+                                __local real2* tile, unsigned int rows, unsigned int cols) {
+   const uint lx = get_local_id(0);
+   const uint ly = get_local_id(1);
+   const uint tile_size = get_local_size(0);
+   uint x = get_group_id(0)*tile_size + lx;
+   uint y = get_group_id(1)*tile_size + ly;
+
+   if (x < cols && y < rows)
+      tile[ly*(tile_size + 1) + lx] = data[y*cols + x];
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   x = get_group_id(1)*tile_size + lx;
+   y = get_group_id(0)*tile_size + ly;
+   if (x < rows && y < cols)
+      output[y*rows + x] = tile[lx*(tile_size + 1) + ly];
+}
+
+// Strided transforms are copied to the device with the points in between, and packed for
+// the passes by owl_fft_gather: element t of transform batch moves from batch*dist + t*stride
+// to batch*n + t. owl_fft_scatter puts the result back in place for the copy to the host.
+__kernel void owl_fft_gather(__global const real2* data, __global real2* output,
+                             unsigned int n, unsigned int stride, unsigned int dist) {
+   const uint t = get_global_id(0);
+   const uint batch = get_global_id(1);
+
+   output[batch*n + t] = data[batch*dist + t*stride];
+}
+
+__kernel void owl_fft_scatter(__global const real2* data, __global real2* output,
+                              unsigned int n, unsigned int stride, unsigned int dist) {
+   const uint t = get_global_id(0);
+   const uint batch = get_global_id(1);
+
+   output[batch*dist + t*stride] = data[batch*n + t];
+}
+
+// Transforms of any length n with Bluestein's algorithm. With tk = (t^2 + k^2 - (k - t)^2)/2
+// the DFT becomes the convolution X[k] = c[k] sum_t (x[t] c[t]) conj(c[k - t]), c[t] = w_{2n}^(t^2),
+// done with power-of-two transforms of m >= 2n - 1 points. Transforms of length n are
+// stored back to back with distance n, the padded ones with distance m.
+__kernel void owl_fft_bluestein_pre(__global const real2* data, __global real2* output,
+                                    __global const real2* chirp, unsigned int n, unsigned int m, real2 pre) {
+   const uint t = get_global_id(0);
+   const uint batch = get_global_id(1);
+
+   output[batch*m + t] = t < n ? mul(pre*data[batch*n + t], chirp[t]) : (real2)(0);
+}
+
+// Multiply by the spectrum of the chirp, which also holds the 1/m of the inverse transform.
+// The inverse transform is done as a forward one of the conjugate, conjugated again
+// by owl_fft_bluestein_post.
+__kernel void owl_fft_bluestein_multiply(__global real2* data, __global const real2* filter, unsigned int m) {
+   const uint t = get_global_id(0);
+   const uint batch = get_global_id(1);
+
+   const real2 z = mul(data[batch*m + t], filter[t]);
+   data[batch*m + t] = (real2)(z.x, -z.y);
+}
+
+__kernel void owl_fft_bluestein_post(__global const real2* data, __global real2* output,
+                                     __global const real2* chirp, unsigned int n, unsigned int m, real2 post) {
+   const uint k = get_global_id(0);
+   const uint batch = get_global_id(1);
+
+   const real2 z = data[batch*m + k];
+   output[batch*n + k] = post*mul((real2)(z.x, -z.y), chirp[k]);
+}
+
+// Pointwise product of a spectrum with the spectrum of a filter, for FFT convolutions.
+// Correlations use the conjugate of the filter.
+__kernel void owl_fft_multiply(__global real2* data, __global const real2* filter, unsigned int conjugate) {
+   const uint k = get_global_id(0);
+   real2 f = filter[k];
+
+   if (conjugate)
+      f.y = -f.y;
+   data[k] = mul(data[k], f);
 }
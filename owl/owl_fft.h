@@ -9,40 +9,205 @@
 
 #include <CL/cl.h>
 
+// Enough passes for any size addressable with cl_uint
+#define OWL_FFT_MAX_FACTORS 32
+
+#define OWL_FFT_MAX_RANK 3
+
+typedef enum {
+   OWL_FFT_SINGLE,                           // float data, complex values as float pairs
+   OWL_FFT_DOUBLE                            // double data, needs cl_khr_fp64
+} owl_fft_precision;
+
 typedef struct {
    owl_opencl_handle* opencl;
+   owl_fft_precision precision;
+   size_t real_size;                         // size of one real value on the device
    cl_program program;
-   cl_kernel fft_kernel;
+   cl_kernel radix2_kernel;
+   cl_kernel radix4_kernel;
+   cl_kernel radix8_kernel;
+   cl_kernel local_kernel;
+   cl_kernel bitreverse_kernel;
+   cl_kernel local_inplace_kernel;
+   cl_kernel inplace_kernel;
+   cl_kernel r2c_kernel;
+   cl_kernel c2r_kernel;
+   cl_kernel transpose_kernel;
+   cl_kernel gather_kernel;
+   cl_kernel scatter_kernel;
+   cl_kernel bluestein_pre_kernel;
+   cl_kernel bluestein_multiply_kernel;
+   cl_kernel bluestein_post_kernel;
+   size_t max_local_n;                       // largest transform that fits in local memory
+   size_t local_work_size;                   // largest usable work-group size of local_kernel
+   size_t tile_size;                         // edge of the square tiles of transpose_kernel
 } owl_fft_handle;
 
-typedef struct {
-   cl_uint n;                   // data size
-   cl_uint nf;                  // number of factors
-   cl_mem factor;               // array of factors
-   cl_mem twiddle;              // twiddle factors
-   cl_mem trig;                 // trigonometric lookup table
+// Transforms that fit in local memory are done in one kernel launch. Larger ones
+// are split into n = (n/local_n)*local_n: the global passes do the transforms of length
+// n/local_n first, and the local memory kernel finishes with the ones of length local_n.
+// Other lengths than powers of two are done with Bluestein's algorithm as a convolution
+// computed with transforms of a power of two m >= 2n - 1, and only the last fields are used.
+typedef struct owl_fft_complex_wavetable {
+   cl_uint n;                                // data size
+   cl_uint workspace_n;                      // workspace points needed per transform, n or m
+   cl_uint local_n;                          // size of the transforms done in local memory
+   cl_uint nf;                               // number of global passes
+   cl_uint factor[OWL_FFT_MAX_FACTORS];      // radix of each global pass
+   cl_mem twiddle;                           // twiddle factors of the global passes
+   cl_mem trig;                              // n-th roots of unity for the local memory kernel
+   struct owl_fft_complex_wavetable* bluestein; // wavetable of the m-point transforms, or NULL
+   cl_mem chirp;                             // w_{2n}^(t^2), t < n
+   cl_mem filter;                            // spectrum of the conjugate chirp, divided by m
 } owl_fft_complex_wavetable;
 
+// Real transforms of n points are computed with a complex transform of n/2 points.
+typedef struct {
+   cl_uint n;                                // number of real data points
+   owl_fft_complex_wavetable* complex;       // wavetable of the n/2 point complex transform
+   cl_mem trig;                              // w_n^k for k <= n/2
+} owl_fft_real_wavetable;
+
+// Multidimensional transforms of row-major data, n[rank - 1] being the contiguous axis.
+typedef struct {
+   cl_uint rank;
+   size_t n[OWL_FFT_MAX_RANK];
+   size_t size;                              // total number of points
+   owl_fft_complex_wavetable* axes[OWL_FFT_MAX_RANK];
+} owl_fft_complex_wavetable_nd;
+
+// Out-of-place transforms ping-pong between the two buffers. An in-place
+// workspace only has buffers[0], and buffers[1] is NULL.
 typedef struct {
    cl_uint n;
    cl_mem buffers[2];
 } owl_fft_complex_workspace;
 
 
-owl_fft_handle* owl_fft_init(owl_opencl_handle* opencl);
+/**
+ * Build the kernels for the given precision. Both precisions come from the same source,
+ * double precision is selected with a define and fails on devices without cl_khr_fp64.
+ * All data passed to the transforms of the handle is float or double accordingly.
+ */
+owl_fft_handle* owl_fft_init(owl_opencl_handle* opencl, owl_fft_precision precision);
 void owl_fft_free(owl_fft_handle* handle);
 
+/**
+ * Plan a transform of size n: factorize n into radix-8, 4 and 2 passes
+ * and precompute the twiddle factors of every pass on the device.
+ * Any other n is planned for Bluestein's algorithm, which costs about three power-of-two
+ * transforms of 2n to 4n points. The chirp and its spectrum are precomputed here.
+ * Workspaces must have wavetable->workspace_n points for each transform.
+ */
+owl_fft_complex_wavetable* owl_fft_complex_wavetable_alloc(owl_fft_handle* handle, size_t n);
+
+void owl_fft_complex_wavetable_free(owl_fft_complex_wavetable* wavetable);
+
+owl_fft_complex_wavetable_nd* owl_fft_complex_wavetable_nd_alloc(owl_fft_handle* handle, cl_uint rank, const size_t* n);
+
+void owl_fft_complex_wavetable_nd_free(owl_fft_complex_wavetable_nd* wavetable);
+
 owl_fft_complex_workspace* owl_fft_complex_workspace_alloc(owl_fft_handle* handle, size_t n);
 
+/**
+ * Allocate a workspace with a single device buffer. Transforms using it are
+ * done in place, which halves the device memory needed at the cost of a bit
+ * reversal pass for transforms that do not fit in local memory.
+ */
+owl_fft_complex_workspace* owl_fft_complex_workspace_alloc_inplace(owl_fft_handle* handle, size_t n);
+
 void owl_fft_complex_workspace_free(owl_fft_complex_workspace* workspace);
 
 // Should we really define "owl_complex_packed_array" as in gsl?
-int owl_fft_complex_forward (owl_fft_handle* handle, float* data, size_t stride, size_t n,
+// Element i is at ((float*)data)[2*i*stride], or double for a double precision handle. Up to a small
+// stride the whole span of the data is copied and the points are packed on the device, so the values
+// in between are copied back unchanged and must not be modified during the call. Larger strides are
+// copied point by point. The host data is never reordered.
+int owl_fft_complex_forward (owl_fft_handle* handle, void* data, size_t stride, size_t n,
                              const owl_fft_complex_wavetable* wavetable,
                              owl_fft_complex_workspace* workspace);
 
-int owl_fft_complex_inverse (owl_fft_handle* handle, float* data, size_t stride, size_t n,
+/**
+ * Forward transform of howmany signals of length n in one go: the whole batch is moved
+ * with one transfer in each direction and every pass is a single kernel launch.
+ * @param data Transforms stored as interleaved complex values, the first element of
+ *             transform i is at complex index i*dist.
+ * @param dist Distance between the first elements of consecutive transforms, at least n.
+ * @param workspace Workspace allocated for at least n*howmany points.
+ */
+int owl_fft_complex_forward_batch (owl_fft_handle* handle, void* data, size_t n, size_t howmany, size_t dist,
+                                   const owl_fft_complex_wavetable* wavetable,
+                                   owl_fft_complex_workspace* workspace);
+
+// Inverse transforms are normalized, inverse(forward(x)) = x.
+int owl_fft_complex_inverse (owl_fft_handle* handle, void* data, size_t stride, size_t n,
                              const owl_fft_complex_wavetable* wavetable,
                              owl_fft_complex_workspace* workspace);
 
+int owl_fft_complex_inverse_batch (owl_fft_handle* handle, void* data, size_t n, size_t howmany, size_t dist,
+                                   const owl_fft_complex_wavetable* wavetable,
+                                   owl_fft_complex_workspace* workspace);
+
+/**
+ * Enqueue a forward transform of howmany packed signals of length n between device buffers.
+ * Nothing is copied to or from the host and the call never blocks, so the transform can be
+ * chained with other kernels on the queue of the owl_opencl_handle, which must be in order.
+ * @param input Device buffer holding n*howmany complex values, only read by the first pass.
+ * @param output Device buffer for the result, may be the same as input.
+ * @param workspace Workspace for at least n*howmany points, with buffers distinct from input and output.
+ *                  With an in-place workspace the input is first copied to output.
+ * @param num_events Number of events in wait_list.
+ * @param wait_list Events to complete before the transform starts, may be NULL.
+ * @param event Returns an event signalling the completion of the transform, may be NULL.
+ */
+int owl_fft_complex_forward_enqueue (owl_fft_handle* handle, cl_mem input, cl_mem output, size_t n, size_t howmany,
+                                     const owl_fft_complex_wavetable* wavetable,
+                                     owl_fft_complex_workspace* workspace,
+                                     cl_uint num_events, const cl_event* wait_list, cl_event* event);
+
+int owl_fft_complex_inverse_enqueue (owl_fft_handle* handle, cl_mem input, cl_mem output, size_t n, size_t howmany,
+                                     const owl_fft_complex_wavetable* wavetable,
+                                     owl_fft_complex_workspace* workspace,
+                                     cl_uint num_events, const cl_event* wait_list, cl_event* event);
+
+/**
+ * Multidimensional transform of 1 <= rank <= OWL_FFT_MAX_RANK. The data stays on the device
+ * between the axes, which are brought to the contiguous position in turn with tiled transposes.
+ * @param workspace Out-of-place workspace for at least the total number of points.
+ */
+int owl_fft_complex_forward_nd (owl_fft_handle* handle, void* data,
+                                const owl_fft_complex_wavetable_nd* wavetable,
+                                owl_fft_complex_workspace* workspace);
+
+int owl_fft_complex_inverse_nd (owl_fft_handle* handle, void* data,
+                                const owl_fft_complex_wavetable_nd* wavetable,
+                                owl_fft_complex_workspace* workspace);
+
+// n must be even.
+owl_fft_real_wavetable* owl_fft_real_wavetable_alloc(owl_fft_handle* handle, size_t n);
+
+void owl_fft_real_wavetable_free(owl_fft_real_wavetable* wavetable);
+
+/**
+ * Transform n real values. The even and odd samples are packed into an n/2 point complex
+ * transform, so only n floats are sent to the device and half of the work is done.
+ * @param data n real values.
+ * @param spectrum Room for the n/2 + 1 complex values X[0], ..., X[n/2] of the spectrum,
+ *                 the rest follows from X[n - k] = conj(X[k]).
+ * @param workspace A complex workspace for at least n/2 + 1 points, and
+ *                  wavetable->complex->workspace_n if n/2 is not a power of two.
+ */
+int owl_fft_real_forward (owl_fft_handle* handle, const void* data, void* spectrum, size_t n,
+                          const owl_fft_real_wavetable* wavetable,
+                          owl_fft_complex_workspace* workspace);
+
+/**
+ * Inverse of owl_fft_real_forward: n real values from the n/2 + 1 complex values of
+ * the spectrum. The transform is normalized like owl_fft_complex_inverse.
+ */
+int owl_fft_real_inverse (owl_fft_handle* handle, const void* spectrum, void* data, size_t n,
+                          const owl_fft_real_wavetable* wavetable,
+                          owl_fft_complex_workspace* workspace);
+
 #endif
@@ -1,6 +1,10 @@
 #include "owl_opencl.h"
+#include "opencl_cache.h"
 #include "owl_errno.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+
 owl_opencl_handle* owl_opencl_init(cl_context context, cl_command_queue queue) {
    cl_int opencl_error;
 
@@ -55,3 +59,38 @@ void owl_opencl_free(owl_opencl_handle* handle) {
    free(handle->devices);
    free(handle);
 }
+
+
+
+int owl_opencl_build_program(owl_opencl_handle* handle, const char* source, size_t length, const char* options,
+                             cl_program* program) {
+   cl_int opencl_error;
+   uint64_t key;
+
+   opencl_error = opencl_cache_key(1, handle->devices, 1, &source, &length, options, &key);
+   if (opencl_error != CL_SUCCESS)
+      OWL_ERROR(NULL, opencl_error);
+
+   char* path = opencl_cache_program_path("owl", key);
+   if (path != NULL) {
+      *program = opencl_cache_load(handle->context, 1, handle->devices, path, key, options);
+      if (*program != NULL) {
+         free(path);
+         return OWL_SUCCESS;
+      }
+   }
+
+   *program = clCreateProgramWithSource(handle->context, 1, &source, &length, &opencl_error);
+   if (opencl_error == CL_SUCCESS)
+      opencl_error = clBuildProgram(*program, 1, handle->devices, options, NULL, NULL);
+   if (opencl_error != CL_SUCCESS) {
+      free(path);
+      OWL_ERROR(NULL, opencl_error);
+   }
+
+   if (path != NULL)
+      opencl_cache_store(*program, 1, handle->devices, path, key);
+   free(path);
+
+   return OWL_SUCCESS;
+}
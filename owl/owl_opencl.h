@@ -31,4 +31,20 @@ owl_opencl_handle* owl_opencl_init(cl_context context, cl_command_queue queue);
  */
 void owl_opencl_free(owl_opencl_handle* handle);
 
+/**
+ * Creates and builds a program for the first device of the handle. The binary is cached
+ * under a hash of the source, the options and the device and driver, and later builds
+ * load it instead of compiling. A cached binary that the driver rejects is rebuilt from
+ * source and replaced. The cache is in $OPENCL_CACHE_DIR if it is set, otherwise in owl
+ * under $XDG_CACHE_HOME or ~/.cache. An empty OPENCL_CACHE_DIR turns it off.
+ * @param handle owl_opencl_handle with the context and the device.
+ * @param source Source of the program.
+ * @param length Length of the source.
+ * @param options Build options.
+ * @param program Will be updated to contain the built program.
+ * @return OWL_SUCCESS, or the error code.
+ */
+int owl_opencl_build_program(owl_opencl_handle* handle, const char* source, size_t length, const char* options,
+                             cl_program* program);
+
 #endif
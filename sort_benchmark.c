@@ -0,0 +1,479 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "opencl_primitives.h"
+#include "opencl_utils.h"
+
+// Radix sort and reduction of random keys on the first device, against qsort and a loop
+// on the host. The device times include only the kernels, not the transfers. Before the
+// timing, the other primitives are checked against the host for each element type.
+
+// An element of any of the types of the primitives, with the same bits as on the device
+typedef union {
+   cl_uint u;
+   cl_int i;
+   cl_float f;
+} element;
+
+static const char* type_names[OPENCL_N_TYPES] = {"uint", "int", "float"};
+
+// Predicates of the compaction checks, the same as keep() on the host
+static const char* conditions[OPENCL_N_TYPES] = {"x % 3 == 0 && i != 5", "x < 0", "x > 1.5f"};
+
+// xorshift32, any fixed sequence will do
+static cl_uint xorshift(cl_uint* state) {
+   *state ^= *state << 13;
+   *state ^= *state >> 17;
+   *state ^= *state << 5;
+   return *state;
+}
+
+static int compare_keys(const void* a, const void* b) {
+   cl_uint x = *(const cl_uint*)a, y = *(const cl_uint*)b;
+   return (x > y) - (x < y);
+}
+
+static double seconds_since(const struct timespec* start) {
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start->tv_sec) + 1e-9*(now.tv_nsec - start->tv_nsec);
+}
+
+static bool benchmark(cl_uint n, bool with_values);
+static bool check_primitives(opencl_handle* opencl, opencl_primitives* primitives);
+static bool check_scan(opencl_handle* opencl, opencl_primitives* primitives, opencl_element_type type,
+                       bool inclusive, cl_uint n, cl_uint* state);
+static bool check_segmented_reduce(opencl_handle* opencl, opencl_primitives* primitives,
+                                   opencl_element_type type, cl_uint n, cl_uint* state);
+static bool check_compaction(opencl_handle* opencl, opencl_predicate* predicate, bool partition, bool with_output,
+                             bool with_indices, cl_uint n, cl_uint* state);
+
+static void usage(const char* name) {
+   printf("Usage: %s [-n keys] [-v]\n", name);
+   printf("  -n  number of keys, default 16777216\n");
+   printf("  -v  sort the indices of the keys along as values\n");
+}
+
+int main(int argc, char** argv) {
+   cl_uint n = 1 << 24;
+   bool with_values = false;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:v")) != -1) {
+      switch (opt) {
+         case 'n':
+            n = strtoul(optarg, NULL, 10);
+            break;
+         case 'v':
+            with_values = true;
+            break;
+         default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+   if (n == 0) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   return benchmark(n, with_values) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static bool benchmark(cl_uint n, bool with_values) {
+   cl_int opencl_error;
+   opencl_handle opencl = {0};
+   opencl_primitives primitives;
+   struct timespec start;
+
+   if (!opencl_discover(&opencl, CL_DEVICE_TYPE_ALL) || !opencl_setup(&opencl, 1))
+      return false;
+   if (!opencl_primitives_init(&primitives, &opencl, 0))
+      return false;
+
+   char device_name[256];
+   opencl_error = clGetDeviceInfo(opencl.devices[0], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+   OPENCL_CHECK(opencl_error);
+   printf("%u keys on %s\n", n, device_name);
+
+   if (!check_primitives(&opencl, &primitives))
+      return false;
+
+   cl_uint* keys     = (cl_uint*) malloc(n*sizeof(cl_uint));
+   cl_uint* sorted   = (cl_uint*) malloc(n*sizeof(cl_uint));
+   cl_uint* expected = (cl_uint*) malloc(n*sizeof(cl_uint));
+   cl_uint* values   = (cl_uint*) malloc(n*sizeof(cl_uint));
+   if (keys == NULL || sorted == NULL || expected == NULL || values == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+
+   cl_uint state = 2463534242u;
+   for (cl_uint i = 0; i < n; i++) {
+      keys[i] = xorshift(&state);
+      values[i] = i;
+   }
+
+   cl_mem key_buffer = clCreateBuffer(opencl.context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   cl_mem value_buffer = NULL;
+   if (with_values) {
+      value_buffer = clCreateBuffer(opencl.context, CL_MEM_READ_WRITE, n*sizeof(cl_uint), NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+   }
+   cl_mem sum_buffer = clCreateBuffer(opencl.context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+
+   // The first round builds the kernels and allocates the buffers, the second one is timed
+   double sort_time = 0;
+   for (int round = 0; round < 2; round++) {
+      opencl_error = clEnqueueWriteBuffer(opencl.queues[0], key_buffer, CL_TRUE, 0, n*sizeof(cl_uint), keys,
+                                          0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+      if (with_values) {
+         opencl_error = clEnqueueWriteBuffer(opencl.queues[0], value_buffer, CL_TRUE, 0, n*sizeof(cl_uint), values,
+                                             0, NULL, NULL);
+         OPENCL_CHECK(opencl_error);
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if (!opencl_sort(&primitives, key_buffer, value_buffer, n))
+         return false;
+      opencl_error = clFinish(opencl.queues[0]);
+      OPENCL_CHECK(opencl_error);
+      sort_time = seconds_since(&start);
+   }
+
+   memcpy(expected, keys, n*sizeof(cl_uint));
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   qsort(expected, n, sizeof(cl_uint), compare_keys);
+   double qsort_time = seconds_since(&start);
+
+   printf("opencl_sort: %8.3f s, %8.2f Mkeys/s\n", sort_time, 1e-6*n/sort_time);
+   printf("qsort:       %8.3f s, %8.2f Mkeys/s\n", qsort_time, 1e-6*n/qsort_time);
+
+   opencl_error = clEnqueueReadBuffer(opencl.queues[0], key_buffer, CL_TRUE, 0, n*sizeof(cl_uint), sorted,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+   if (memcmp(sorted, expected, n*sizeof(cl_uint)) != 0) {
+      printf("The sorted keys differ from qsort!\n");
+      return false;
+   }
+
+   // The values must be the original places of the keys, in order for equal keys
+   if (with_values) {
+      opencl_error = clEnqueueReadBuffer(opencl.queues[0], value_buffer, CL_TRUE, 0, n*sizeof(cl_uint), values,
+                                         0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+      for (cl_uint i = 0; i < n; i++) {
+         if (values[i] >= n || keys[values[i]] != sorted[i] ||
+             (i > 0 && sorted[i] == sorted[i - 1] && values[i] <= values[i - 1])) {
+            printf("The values did not move with the keys!\n");
+            return false;
+         }
+      }
+   }
+
+   // The sum wraps around in both
+   cl_uint sum = 0, device_sum;
+   if (!opencl_reduce(&primitives, key_buffer, n, OPENCL_UINT, sum_buffer))
+      return false;
+   opencl_error = clFinish(opencl.queues[0]);
+   OPENCL_CHECK(opencl_error);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   if (!opencl_reduce(&primitives, key_buffer, n, OPENCL_UINT, sum_buffer))
+      return false;
+   opencl_error = clFinish(opencl.queues[0]);
+   OPENCL_CHECK(opencl_error);
+   double reduce_time = seconds_since(&start);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for (cl_uint i = 0; i < n; i++)
+      sum += keys[i];
+   double loop_time = seconds_since(&start);
+
+   printf("opencl_reduce: %8.3f s, %8.2f Mkeys/s\n", reduce_time, 1e-6*n/reduce_time);
+   printf("host loop:     %8.3f s, %8.2f Mkeys/s\n", loop_time, 1e-6*n/loop_time);
+
+   opencl_error = clEnqueueReadBuffer(opencl.queues[0], sum_buffer, CL_TRUE, 0, sizeof(cl_uint), &device_sum,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+   if (device_sum != sum) {
+      printf("The sums differ: %u on the device, %u on the host!\n", device_sum, sum);
+      return false;
+   }
+
+   clReleaseMemObject(key_buffer);
+   if (value_buffer != NULL)
+      clReleaseMemObject(value_buffer);
+   clReleaseMemObject(sum_buffer);
+   free(keys);
+   free(sorted);
+   free(expected);
+   free(values);
+
+   return opencl_primitives_free(&primitives) && opencl_free(&opencl);
+}
+
+
+// Small values, so that the sums of floats are exact in any order
+static void fill_elements(element* elements, cl_uint n, opencl_element_type type, cl_uint* state) {
+   for (cl_uint i = 0; i < n; i++) {
+      cl_uint random = xorshift(state);
+      if (type == OPENCL_UINT)
+         elements[i].u = random;
+      else if (type == OPENCL_INT)
+         elements[i].i = (cl_int) (random % 1000) - 500;
+      else
+         elements[i].f = (cl_float) (random % 4);
+   }
+}
+
+// Two's complement, so the ints wrap around as the uints do
+static element add_elements(element a, element b, opencl_element_type type) {
+   element sum;
+   if (type == OPENCL_FLOAT)
+      sum.f = a.f + b.f;
+   else
+      sum.u = a.u + b.u;
+   return sum;
+}
+
+static bool keep(element x, cl_uint i, opencl_element_type type) {
+   if (type == OPENCL_UINT)
+      return x.u % 3 == 0 && i != 5;
+   else if (type == OPENCL_INT)
+      return x.i < 0;
+   else
+      return x.f > 1.5f;
+}
+
+
+// Each type at sizes of one block, two levels of blocks with a short last block, and three
+// levels, in both modes of each primitive.
+static bool check_primitives(opencl_handle* opencl, opencl_primitives* primitives) {
+   cl_uint state = 88675123u;
+
+   for (int type = 0; type < OPENCL_N_TYPES; type++) {
+      // The first scan builds the kernels of the type, which sets its block size
+      if (!check_scan(opencl, primitives, type, true, 1, &state))
+         return false;
+      cl_uint block_size = 2*primitives->wg_sizes[type];
+      cl_uint sizes[4] = {1, block_size - 1, block_size + 1, block_size*block_size + block_size + 3};
+      for (int s = 0; s < 4; s++) {
+         if (!check_scan(opencl, primitives, type, true, sizes[s], &state) ||
+             !check_scan(opencl, primitives, type, false, sizes[s], &state) ||
+             !check_segmented_reduce(opencl, primitives, type, sizes[s], &state))
+            return false;
+      }
+
+      // The counts of the blocks are scanned as uints, in two levels for the largest size
+      opencl_predicate predicate;
+      if (!opencl_predicate_init(&predicate, primitives, type, conditions[type]))
+         return false;
+      block_size = 2*predicate.wg_size;
+      cl_uint count_block_size = 2*primitives->wg_sizes[OPENCL_UINT];
+      cl_uint compaction_sizes[5] = {0, 1, block_size - 1, block_size + 1,
+                                     block_size*count_block_size + block_size + 3};
+      for (int s = 0; s < 5; s++) {
+         for (int partition = 0; partition < 2; partition++) {
+            if (!check_compaction(opencl, &predicate, partition, true, false, compaction_sizes[s], &state) ||
+                !check_compaction(opencl, &predicate, partition, false, true, compaction_sizes[s], &state) ||
+                !check_compaction(opencl, &predicate, partition, true, true, compaction_sizes[s], &state))
+               return false;
+         }
+      }
+      if (!opencl_predicate_free(&predicate))
+         return false;
+   }
+
+   printf("Scans, segmented reductions, compaction and partitioning match the host\n");
+   return true;
+}
+
+
+static bool check_scan(opencl_handle* opencl, opencl_primitives* primitives, opencl_element_type type,
+                       bool inclusive, cl_uint n, cl_uint* state) {
+   cl_int opencl_error;
+
+   element* elements = (element*) malloc(n*sizeof(element));
+   element* scanned  = (element*) malloc(n*sizeof(element));
+   if (elements == NULL || scanned == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   fill_elements(elements, n, type, state);
+
+   cl_mem buffer = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, n*sizeof(element),
+                                  elements, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   if (!opencl_scan(primitives, buffer, n, type, inclusive))
+      return false;
+   opencl_error = clEnqueueReadBuffer(opencl->queues[0], buffer, CL_TRUE, 0, n*sizeof(element), scanned,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   element sum = {0};
+   for (cl_uint i = 0; i < n; i++) {
+      if (inclusive)
+         sum = add_elements(sum, elements[i], type);
+      if (scanned[i].u != sum.u) {
+         printf("The %s scan of %u %s elements differs from the host at %u!\n",
+                inclusive ? "inclusive" : "exclusive", n, type_names[type], i);
+         return false;
+      }
+      if (!inclusive)
+         sum = add_elements(sum, elements[i], type);
+   }
+
+   clReleaseMemObject(buffer);
+   free(elements);
+   free(scanned);
+   return true;
+}
+
+
+// Random segments, so some are empty and the long ones span several work-groups
+static bool check_segmented_reduce(opencl_handle* opencl, opencl_primitives* primitives,
+                                   opencl_element_type type, cl_uint n, cl_uint* state) {
+   cl_int opencl_error;
+   cl_uint n_segments = n/1024 + 3;
+
+   element* elements = (element*) malloc(n*sizeof(element));
+   cl_uint* offsets  = (cl_uint*) malloc((n_segments + 1)*sizeof(cl_uint));
+   element* sums     = (element*) malloc(n_segments*sizeof(element));
+   if (elements == NULL || offsets == NULL || sums == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   fill_elements(elements, n, type, state);
+   offsets[0] = offsets[1] = 0;
+   for (cl_uint s = 2; s < n_segments; s++)
+      offsets[s] = xorshift(state) % (n + 1);
+   offsets[n_segments] = n;
+   qsort(offsets, n_segments + 1, sizeof(cl_uint), compare_keys);
+
+   cl_mem buffer = clCreateBuffer(opencl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n*sizeof(element),
+                                  elements, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   cl_mem offset_buffer = clCreateBuffer(opencl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                         (n_segments + 1)*sizeof(cl_uint), offsets, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   cl_mem sum_buffer = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE, n_segments*sizeof(element), NULL,
+                                      &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   if (!opencl_segmented_reduce(primitives, buffer, offset_buffer, n_segments, type, sum_buffer))
+      return false;
+   opencl_error = clEnqueueReadBuffer(opencl->queues[0], sum_buffer, CL_TRUE, 0, n_segments*sizeof(element), sums,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+
+   for (cl_uint s = 0; s < n_segments; s++) {
+      element sum = {0};
+      for (cl_uint i = offsets[s]; i < offsets[s + 1]; i++)
+         sum = add_elements(sum, elements[i], type);
+      if (sums[s].u != sum.u) {
+         printf("The segmented reduction of %u %s elements differs from the host in segment %u!\n", n,
+                type_names[type], s);
+         return false;
+      }
+   }
+
+   clReleaseMemObject(buffer);
+   clReleaseMemObject(offset_buffer);
+   clReleaseMemObject(sum_buffer);
+   free(elements);
+   free(offsets);
+   free(sums);
+   return true;
+}
+
+
+// The count is read back from its buffer, where it stays for later kernels
+static bool check_compaction(opencl_handle* opencl, opencl_predicate* predicate, bool partition, bool with_output,
+                             bool with_indices, cl_uint n, cl_uint* state) {
+   cl_int opencl_error;
+   opencl_element_type type = predicate->type;
+   const char* name = partition ? "partition" : "compaction";
+   // Buffers cannot be empty
+   size_t size = n > 0 ? n : 1;
+   cl_uint count;
+
+   element* elements = (element*) malloc(size*sizeof(element));
+   element* output   = (element*) malloc(size*sizeof(element));
+   cl_uint* indices  = (cl_uint*) malloc(size*sizeof(cl_uint));
+   if (elements == NULL || output == NULL || indices == NULL) {
+      printf("Out of memory!\n");
+      return false;
+   }
+   fill_elements(elements, n, type, state);
+
+   cl_mem buffer = clCreateBuffer(opencl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size*sizeof(element),
+                                  elements, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+   cl_mem output_buffer = NULL, index_buffer = NULL;
+   if (with_output) {
+      output_buffer = clCreateBuffer(opencl->context, CL_MEM_WRITE_ONLY, size*sizeof(element), NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+   }
+   if (with_indices) {
+      index_buffer = clCreateBuffer(opencl->context, CL_MEM_WRITE_ONLY, size*sizeof(cl_uint), NULL, &opencl_error);
+      OPENCL_CHECK(opencl_error);
+   }
+   cl_mem count_buffer = clCreateBuffer(opencl->context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &opencl_error);
+   OPENCL_CHECK(opencl_error);
+
+   if (!(partition ? opencl_partition : opencl_compact)(predicate, buffer, n, output_buffer, index_buffer,
+                                                        count_buffer))
+      return false;
+   opencl_error = clEnqueueReadBuffer(opencl->queues[0], count_buffer, CL_TRUE, 0, sizeof(cl_uint), &count,
+                                      0, NULL, NULL);
+   OPENCL_CHECK(opencl_error);
+   if (with_output) {
+      opencl_error = clEnqueueReadBuffer(opencl->queues[0], output_buffer, CL_TRUE, 0, size*sizeof(element),
+                                         output, 0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+   }
+   if (with_indices) {
+      opencl_error = clEnqueueReadBuffer(opencl->queues[0], index_buffer, CL_TRUE, 0, size*sizeof(cl_uint),
+                                         indices, 0, NULL, NULL);
+      OPENCL_CHECK(opencl_error);
+   }
+
+   // The kept elements in order, then for a partition the others in order
+   cl_uint kept = 0;
+   for (cl_uint i = 0; i < n; i++)
+      kept += keep(elements[i], i, type);
+   if (count != kept) {
+      printf("The %s of %u %s elements kept %u of them, the host %u!\n", name, n, type_names[type], count, kept);
+      return false;
+   }
+   cl_uint next_kept = 0, next_other = kept, end = partition ? n : kept;
+   for (cl_uint i = 0; i < n; i++) {
+      cl_uint* next = keep(elements[i], i, type) ? &next_kept : &next_other;
+      if (*next >= end)
+         continue;
+      if ((with_output && output[*next].u != elements[i].u) || (with_indices && indices[*next] != i)) {
+         printf("The %s of %u %s elements differs from the host at %u!\n", name, n, type_names[type], *next);
+         return false;
+      }
+      (*next)++;
+   }
+
+   clReleaseMemObject(buffer);
+   if (output_buffer != NULL)
+      clReleaseMemObject(output_buffer);
+   if (index_buffer != NULL)
+      clReleaseMemObject(index_buffer);
+   clReleaseMemObject(count_buffer);
+   free(elements);
+   free(output);
+   free(indices);
+   return true;
+}